@@ -24,11 +24,19 @@ __FBSDID("$FreeBSD$");
 /*
  * Driver for Realtek RTL8812AU/RTL8821AU.
  */
+#include "opt_inet.h"
+#include "opt_inet6.h"
 #include "opt_wlan.h"
 
 #include <sys/param.h>
 #include <sys/sockio.h>
 #include <sys/sysctl.h>
+#include <sys/sbuf.h>
+#include <sys/hash.h>
+#include <sys/refcount.h>
+#include <sys/taskqueue.h>
+#include <sys/buf_ring.h>
+#include <sys/counter.h>
 #include <sys/lock.h>
 #include <sys/mutex.h>
 #include <sys/condvar.h>
@@ -62,6 +70,7 @@ __FBSDID("$FreeBSD$");
 #include <netinet/in_var.h>
 #include <netinet/if_ether.h>
 #include <netinet/ip.h>
+#include <netinet/tcp_lro.h>
 
 #include <net80211/ieee80211_var.h>
 #include <net80211/ieee80211_regdomain.h>
@@ -146,9 +155,16 @@ static device_probe_t	urtwm_match;
 static device_attach_t	urtwm_attach;
 static device_detach_t	urtwm_detach;
 
-static usb_callback_t	urtwm_bulk_tx_callback;
+static usb_callback_t	urtwm_bulk_tx_be_callback;
+static usb_callback_t	urtwm_bulk_tx_bk_callback;
+static usb_callback_t	urtwm_bulk_tx_vi_callback;
+static usb_callback_t	urtwm_bulk_tx_vo_callback;
 static usb_callback_t	urtwm_bulk_rx_callback;
 
+static int		urtwm_get_tunable(struct urtwm_softc *, const char *,
+			    int, int, int);
+static void		urtwm_hist_add(uint64_t *, int, u_int);
+static int		urtwm_sysctl_hist(SYSCTL_HANDLER_ARGS);
 static void		urtwm_radiotap_attach(struct urtwm_softc *);
 static void		urtwm_sysctlattach(struct urtwm_softc *);
 static void		urtwm_drain_mbufq(struct urtwm_softc *);
@@ -170,16 +186,46 @@ static void		urtwm_vap_clear_tx_queue(struct urtwm_softc *,
 static void		urtwm_ff_flush_all(struct urtwm_softc *,
 			    union sec_param *);
 #endif
+static void		urtwm_rx_ext_free(struct mbuf *);
+static void		urtwm_rx_ext_task(void *, int);
+static struct mbuf *	urtwm_rx_mcache_get(struct urtwm_softc *, int);
+static int		urtwm_rx_bcn_filter(struct urtwm_softc *,
+			    const struct ieee80211_frame *, int);
+static void		urtwm_rx_mcache_task(void *, int);
+static void		urtwm_rx_mcache_free(struct urtwm_softc *);
 static struct mbuf *	urtwm_rx_copy_to_mbuf(struct urtwm_softc *,
-			    struct r92c_rx_stat *, int);
+			    struct urtwm_data *, struct r92c_rx_stat *, int);
 static struct mbuf *	urtwm_report_intr(struct urtwm_softc *,
-			    struct usb_xfer *, struct urtwm_data *);
+			    struct urtwm_data *, int);
+static struct mbuf *	urtwm_rx_process(struct urtwm_softc *,
+			    struct urtwm_data *, int);
+static void		urtwm_rx_input(struct urtwm_softc *, struct mbuf *);
+static void		urtwm_rx_deliver(struct urtwm_softc *, struct mbuf *);
+static void		urtwm_vap_input(struct ifnet *, struct mbuf *);
+static void		urtwm_rx_lro_flush(struct urtwm_softc *);
+static void		urtwm_rx_task(void *, int);
 static void		urtwm_c2h_report(struct urtwm_softc *, uint8_t *, int);
 static void		urtwm_ratectl_tx_complete(struct urtwm_softc *,
 			    void *, int);
-static struct mbuf *	urtwm_rxeof(struct urtwm_softc *, uint8_t *, int);
+static struct mbuf *	urtwm_rxeof(struct urtwm_softc *, struct urtwm_data *,
+			    uint8_t *, int);
+static struct ieee80211_node *urtwm_rx_node_lookup(struct urtwm_softc *,
+			    struct urtwm_rx_node_cache *, struct mbuf *,
+			    const struct ieee80211_frame_min *);
+static void		urtwm_rx_ampdu_check(struct urtwm_softc *,
+			    struct ieee80211_node *, struct mbuf *,
+			    const struct ieee80211_frame *, uint32_t);
+static int		urtwm_sysctl_rx_tid_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_rx_node_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_c2h_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_tx_ac_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_tx_queue_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_tx_page_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_tx_bql_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_tx_airtime_stats(SYSCTL_HANDLER_ARGS);
+static int		urtwm_sysctl_tx_ampdu_stats(SYSCTL_HANDLER_ARGS);
 static struct ieee80211_node *urtwm_rx_frame(struct urtwm_softc *,
-			    struct mbuf *, int8_t *);
+			    struct urtwm_rx_node_cache *, struct mbuf *);
 static void		urtwm_txeof(struct urtwm_softc *, struct urtwm_data *,
 			    int);
 static int		urtwm_alloc_list(struct urtwm_softc *,
@@ -190,12 +236,17 @@ static void		urtwm_free_list(struct urtwm_softc *,
 			    struct urtwm_data data[], int);
 static void		urtwm_free_rx_list(struct urtwm_softc *);
 static void		urtwm_free_tx_list(struct urtwm_softc *);
+static void		urtwm_rx_start(struct urtwm_softc *);
 static void		urtwm_r12a_transfer_submit(struct urtwm_softc *,
 			    struct usb_xfer *, struct urtwm_data *);
 static void		urtwm_r21a_transfer_submit(struct urtwm_softc *,
 			    struct usb_xfer *, struct urtwm_data *);
+static void		urtwm_bulk_tx_callback(struct usb_xfer *,
+			    usb_error_t, int);
+static void		urtwm_tx_kick(struct urtwm_softc *, int);
 static struct urtwm_data *	_urtwm_getbuf(struct urtwm_softc *);
 static struct urtwm_data *	urtwm_getbuf(struct urtwm_softc *);
+static void		urtwm_tx_free_frames(struct urtwm_data *);
 static usb_error_t	urtwm_write_region_1(struct urtwm_softc *, uint16_t,
 			    uint8_t *, int);
 static usb_error_t	urtwm_write_1(struct urtwm_softc *, uint16_t, uint8_t);
@@ -246,6 +297,8 @@ static int		urtwm_r12a_check_condition(struct urtwm_softc *,
 static int		urtwm_r21a_check_condition(struct urtwm_softc *,
 			    const uint8_t[]);
 static void		urtwm_config_specific(struct urtwm_softc *);
+static void		urtwm_config_rx(struct urtwm_softc *);
+static void		urtwm_config_tx(struct urtwm_softc *);
 static void		urtwm_config_specific_rom(struct urtwm_softc *);
 static int		urtwm_read_rom(struct urtwm_softc *);
 static void		urtwm_r12a_parse_rom(struct urtwm_softc *,
@@ -307,6 +360,8 @@ static void		urtwm_tsf_sync_enable(struct urtwm_softc *,
 static uint32_t		urtwm_get_tsf_low(struct urtwm_softc *, int);
 static uint32_t		urtwm_get_tsf_high(struct urtwm_softc *, int);
 static void		urtwm_get_tsf(struct urtwm_softc *, uint64_t *, int);
+static uint64_t		urtwm_get_tsf_cached(struct urtwm_softc *, int);
+static void		urtwm_tsf_cache_invalidate(struct urtwm_softc *, int);
 static void		urtwm_r12a_set_led_mini(struct urtwm_softc *, int,
 			    int);
 static void		urtwm_r12a_set_led(struct urtwm_softc *, int, int);
@@ -322,10 +377,19 @@ static int		urtwm_newstate(struct ieee80211vap *,
 static void		urtwm_calib_to(void *);
 static void		urtwm_calib_cb(struct urtwm_softc *,
 			    union sec_param *);
+static void		urtwm_rxagg_write(struct urtwm_softc *, int);
+static void		urtwm_rxagg_to(void *);
+static void		urtwm_rxagg_cb(struct urtwm_softc *,
+			    union sec_param *);
+static int		urtwm_sysctl_rxagg_pin(SYSCTL_HANDLER_ARGS);
 static int8_t		urtwm_r12a_get_rssi_cck(struct urtwm_softc *, void *);
 static int8_t		urtwm_r21a_get_rssi_cck(struct urtwm_softc *, void *);
-static int8_t		urtwm_get_rssi_ofdm(struct urtwm_softc *, void *);
-static int8_t		urtwm_get_rssi(struct urtwm_softc *, int, void *);
+static int8_t		urtwm_get_rssi_ofdm(struct urtwm_softc *, void *,
+			    struct ieee80211_rx_stats *);
+static int8_t		urtwm_get_rssi(struct urtwm_softc *, int, void *,
+			    struct ieee80211_rx_stats *);
+static void		urtwm_update_rxstats(struct urtwm_softc *,
+			    struct urtwm_node *, int, void *, int8_t);
 static void		urtwm_tx_protection(struct urtwm_softc *,
 			    struct r12a_tx_desc *, enum ieee80211_protmode);
 static void		urtwm_tx_raid(struct urtwm_softc *,
@@ -340,10 +404,52 @@ static int		urtwm_tx_raw(struct urtwm_softc *,
 			    struct ieee80211_node *, struct mbuf *,
 			    struct urtwm_data *,
 			    const struct ieee80211_bpf_params *);
-static void		urtwm_tx_start(struct urtwm_softc *, struct mbuf *,
-			    uint8_t, struct urtwm_data *);
+static int		urtwm_tx_qid(struct mbuf *);
+static struct urtwm_data *	urtwm_tx_getbuf(struct urtwm_softc *,
+			    struct mbuf *);
+static const struct r12a_tx_desc *urtwm_tx_tmpl_get(struct urtwm_softc *,
+			    struct ieee80211_node *,
+			    struct ieee80211_channel *,
+			    const struct ieee80211_txparam *, int);
+static int		urtwm_tx_zcopy_ok(struct urtwm_softc *,
+			    struct ieee80211_node *, struct mbuf *,
+			    struct urtwm_data *);
+static void		urtwm_tx_start(struct urtwm_softc *,
+			    struct ieee80211_node *, struct mbuf *, uint8_t,
+			    struct urtwm_data *);
 static void		urtwm_tx_checksum(struct r12a_tx_desc *);
 static int		urtwm_transmit(struct ieee80211com *, struct mbuf *);
+static void		urtwm_tx_bql_reset(struct urtwm_softc *);
+static void		urtwm_tx_bql_complete(struct urtwm_softc *,
+			    struct urtwm_data *, int);
+static void		urtwm_tx_bql_report(struct urtwm_softc *,
+			    const struct r12a_c2h_tx_rpt *);
+static void		urtwm_tx_pg_init(struct urtwm_softc *, int, int, int);
+static int		urtwm_tx_pg_avail(struct urtwm_softc *, int);
+static int		urtwm_tx_pg_charge(struct urtwm_softc *, int,
+			    struct urtwm_data *);
+static void		urtwm_tx_pg_sample_req(struct urtwm_softc *);
+static void		urtwm_tx_pg_sample(struct urtwm_softc *,
+			    union sec_param *);
+static void		urtwm_tx_pg_to(void *);
+static int		urtwm_tx_airtime(struct ieee80211_node *, int, int);
+static void		urtwm_tx_enqueue(struct urtwm_softc *, struct mbuf *);
+static void		urtwm_tx_nq_flush(struct urtwm_softc *,
+			    struct ieee80211vap *);
+static void		urtwm_tx_airtime_report(struct urtwm_softc *,
+			    struct ieee80211_node *,
+			    const struct r12a_c2h_tx_rpt *, int);
+static int		urtwm_tx_ampdu_params(struct urtwm_softc *,
+			    struct ieee80211_node *, int, int *);
+static void		urtwm_tx_ampdu_report(struct urtwm_softc *,
+			    struct ieee80211_node *,
+			    const struct r12a_c2h_tx_rpt *, int);
+static struct mbuf *	urtwm_tx_ac_first(struct urtwm_softc *, int);
+static struct mbuf *	urtwm_tx_ac_dequeue(struct urtwm_softc *, int);
+static int		urtwm_tx_ac_len(struct urtwm_softc *, int);
+static int		urtwm_tx_sched_prio(struct urtwm_softc *, int);
+static int		urtwm_tx_sched_drr(struct urtwm_softc *, int);
+static void		urtwm_tx_task(void *, int);
 static void		urtwm_start(struct urtwm_softc *);
 static void		urtwm_parent(struct ieee80211com *);
 static int		urtwm_ioctl_net(struct ieee80211com *, u_long, void *);
@@ -473,6 +579,14 @@ static void		urtwm_delay(struct urtwm_softc *, int);
 #define urtwm_set_band_5ghz(_sc) \
 	(((_sc)->sc_set_band_5ghz)((_sc)))
 
+/*
+ * Protects urtwm_rx_ext->sc for Rx buffers loaned to the network stack
+ * (they may outlive the softc).
+ */
+static struct mtx urtwm_rx_ext_mtx;
+MTX_SYSINIT(urtwm_rx_ext, &urtwm_rx_ext_mtx, "urtwm Rx loan lock", MTX_DEF);
+static u_int urtwm_rx_orphans;	/* loaned buffers of detached devices */
+
 static struct usb_config urtwm_config[URTWM_N_TRANSFER] = {
 	[URTWM_BULK_RX] = {
 		.type = UE_BULK,
@@ -480,6 +594,7 @@ static struct usb_config urtwm_config[URTWM_N_TRANSFER] = {
 		.direction = UE_DIR_IN,
 		.bufsize = URTWM_RXBUFSZ,
 		.flags = {
+			.ext_buffer = 1,
 			.pipe_bof = 1,
 			.short_xfer_ok = 1
 		},
@@ -489,52 +604,52 @@ static struct usb_config urtwm_config[URTWM_N_TRANSFER] = {
 		.type = UE_BULK,
 		.endpoint = UE_ADDR_ANY,
 		.direction = UE_DIR_OUT,
-		.bufsize = URTWM_TXBUFSZ,
+		.bufsize = URTWM_TXBUFSZ_AGG,
 		.flags = {
 			.ext_buffer = 1,
 			.pipe_bof = 1,
 			.force_short_xfer = 1,
 		},
-		.callback = urtwm_bulk_tx_callback,
+		.callback = urtwm_bulk_tx_be_callback,
 		.timeout = URTWM_TX_TIMEOUT,	/* ms */
 	},
 	[URTWM_BULK_TX_BK] = {
 		.type = UE_BULK,
 		.endpoint = UE_ADDR_ANY,
 		.direction = UE_DIR_OUT,
-		.bufsize = URTWM_TXBUFSZ,
+		.bufsize = URTWM_TXBUFSZ_AGG,
 		.flags = {
 			.ext_buffer = 1,
 			.pipe_bof = 1,
 			.force_short_xfer = 1,
 		},
-		.callback = urtwm_bulk_tx_callback,
+		.callback = urtwm_bulk_tx_bk_callback,
 		.timeout = URTWM_TX_TIMEOUT,	/* ms */
 	},
 	[URTWM_BULK_TX_VI] = {
 		.type = UE_BULK,
 		.endpoint = UE_ADDR_ANY,
 		.direction = UE_DIR_OUT,
-		.bufsize = URTWM_TXBUFSZ,
+		.bufsize = URTWM_TXBUFSZ_AGG,
 		.flags = {
 			.ext_buffer = 1,
 			.pipe_bof = 1,
 			.force_short_xfer = 1
 		},
-		.callback = urtwm_bulk_tx_callback,
+		.callback = urtwm_bulk_tx_vi_callback,
 		.timeout = URTWM_TX_TIMEOUT,	/* ms */
 	},
 	[URTWM_BULK_TX_VO] = {
 		.type = UE_BULK,
 		.endpoint = UE_ADDR_ANY,
 		.direction = UE_DIR_OUT,
-		.bufsize = URTWM_TXBUFSZ,
+		.bufsize = URTWM_TXBUFSZ_AGG,
 		.flags = {
 			.ext_buffer = 1,
 			.pipe_bof = 1,
 			.force_short_xfer = 1
 		},
-		.callback = urtwm_bulk_tx_callback,
+		.callback = urtwm_bulk_tx_vo_callback,
 		.timeout = URTWM_TX_TIMEOUT,	/* ms */
 	},
 };
@@ -549,6 +664,23 @@ static const struct wme_to_queue {
 	{ R92C_EDCA_VO_PARAM, URTWM_BULK_TX_VO}
 };
 
+/*
+ * Rx aggregation profiles (RXDMA_AGG_PG_TH), from the lowest latency
+ * to the highest throughput.
+ */
+static const struct urtwm_rxagg_profile {
+	uint8_t size;	/* R12A_RXDMA_AGG_PG_UNIT */
+	uint8_t time;
+} urtwm_rxagg_profiles[] = {
+	{ 0x01, 0x04 },
+	{ 0x01, 0x10 },		/* USB 2.0 default */
+	{ 0x03, 0x14 },
+	{ 0x05, 0x18 },
+	{ 0x07, 0x1a }		/* USB 3.0 default */
+};
+#define URTWM_RXAGG_DEF_USB2	1
+#define URTWM_RXAGG_DEF_USB3	4
+
 static const uint8_t urtwm_chan_2ghz[] =
 	{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 };
 
@@ -580,7 +712,7 @@ urtwm_attach(device_t self)
 	struct usb_attach_arg *uaa = device_get_ivars(self);
 	struct urtwm_softc *sc = device_get_softc(self);
 	struct ieee80211com *ic = &sc->sc_ic;
-	int error;
+	int error, i;
 
 	device_set_usb_desc(self);
 	sc->sc_flags = URTWM_RXCKSUM_EN | URTWM_RXCKSUM6_EN;
@@ -597,13 +729,49 @@ urtwm_attach(device_t self)
 		sc->sc_debug = debug;
 #endif
 
+	/* Number of bulk-in transfers to keep in flight. */
+	sc->sc_rx_list_count = urtwm_get_tunable(sc, "rx_bufs",
+	    URTWM_RX_LIST_COUNT, 1, URTWM_RX_LIST_MAX);
+	/* Pass Rx buffer slices to net80211 instead of copying them. */
+	sc->sc_rx_zerocopy = urtwm_get_tunable(sc, "rx_zerocopy", 0, 0, 1);
+	/* Process received frames in a separate thread. */
+	sc->sc_rx_deferred = urtwm_get_tunable(sc, "rx_deferred", 0, 0, 1);
+	/* NB: leave one buffer for the bulk-in pipe by default. */
+	sc->sc_rx_queue_max = urtwm_get_tunable(sc, "rx_queue_max",
+	    imax(sc->sc_rx_list_count - 1, 1), 1, sc->sc_rx_list_count);
+	/* Preallocated mbufs for the copying Rx path (0 - disabled). */
+	sc->sc_rx_mcache_max = urtwm_get_tunable(sc, "rx_mbufs",
+	    URTWM_RX_MCACHE_SIZE, 0, URTWM_RX_MCACHE_MAX);
+	/* Drop unchanged beacons from our BSS (0 - disabled). */
+	sc->sc_bcn_filter = urtwm_get_tunable(sc, "bcn_filter", 0, 0,
+	    URTWM_BCN_FILTER_MAX);
+	sc->sc_rx_mcache_lowat = urtwm_get_tunable(sc, "rx_mbufs_lowat",
+	    sc->sc_rx_mcache_max / 4, 0, sc->sc_rx_mcache_max);
+
 	mtx_init(&sc->sc_mtx, device_get_nameunit(self),
 	    MTX_NETWORK_LOCK, MTX_DEF);
 	URTWM_CMDQ_LOCK_INIT(sc);
 	URTWM_NT_LOCK_INIT(sc);
 	callout_init(&sc->sc_calib_to, 0);
 	callout_init(&sc->sc_pwrmode_init, 0);
-	mbufq_init(&sc->sc_snd, ifqmaxlen);
+	callout_init_mtx(&sc->sc_rxagg_to, &sc->sc_mtx, 0);
+	callout_init_mtx(&sc->sc_tx_pg_to, &sc->sc_mtx, 0);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		mbufq_init(&sc->sc_snd[i], ifqmaxlen);
+		TAILQ_INIT(&sc->sc_tx_nodes[i]);
+	}
+	sc->sc_tx_ring = buf_ring_alloc(URTWM_TX_RING_SIZE, M_DEVBUF,
+	    M_WAITOK, &sc->sc_mtx);
+	sc->sc_tx_ring_drops = counter_u64_alloc(M_WAITOK);
+	sc->sc_tx_lock_busy = counter_u64_alloc(M_WAITOK);
+
+	TASK_INIT(&sc->sc_rx_mcache_task, 0, urtwm_rx_mcache_task, sc);
+	if (!sc->sc_rx_zerocopy)
+		urtwm_rx_mcache_task(sc, 0);
+
+	/* Setup Rx aggregation / buffer size (before endpoint setup). */
+	urtwm_config_rx(sc);
+	urtwm_config_tx(sc);
 
 	error = urtwm_setup_endpoints(sc);
 	if (error != 0)
@@ -620,6 +788,12 @@ urtwm_attach(device_t self)
 	/* Setup device-specific configuration (before ROM parsing). */
 	urtwm_config_specific(sc);
 
+	/* Max number of frames per bulk-out transfer (1 - disabled). */
+	sc->sc_tx_agg_max = urtwm_get_tunable(sc, "tx_agg",
+	    sc->tx_agg_desc_num, 1, sc->tx_agg_desc_num);
+	sc->sc_tx_bufsz = (sc->sc_tx_agg_max > 1) ?
+	    URTWM_TXBUFSZ_AGG : URTWM_TXBUFSZ;
+
 	error = urtwm_read_rom(sc);
 	if (error != 0) {
 		device_printf(sc->sc_dev, "%s: cannot read rom, error %d\n",
@@ -681,6 +855,10 @@ urtwm_attach(device_t self)
 	ic->ic_txstream = sc->ntxchains;
 	ic->ic_rxstream = sc->nrxchains;
 
+	/* Reserve space for the Tx descriptor (see urtwm_tx_start()). */
+	if (sc->sc_tx_zcopy)
+		ic->ic_headroom = sizeof(struct r12a_tx_desc);
+
 	/* Enable TX watchdog */
 #ifdef D4054
 	ic->ic_flags_ext |= IEEE80211_FEXT_WATCHDOG;
@@ -713,6 +891,15 @@ urtwm_attach(device_t self)
 	ic->ic_node_free = urtwm_node_free;
 
 	TASK_INIT(&sc->cmdq_task, 0, urtwm_cmdq_cb, sc);
+	TASK_INIT(&sc->sc_rx_ext_task, 0, urtwm_rx_ext_task, sc);
+	TASK_INIT(&sc->sc_rx_task, 0, urtwm_rx_task, sc);
+	TASK_INIT(&sc->sc_tx_task, 0, urtwm_tx_task, sc);
+	if (sc->sc_rx_deferred) {
+		sc->sc_rx_tq = taskqueue_create("urtwm_rx", M_WAITOK,
+		    taskqueue_thread_enqueue, &sc->sc_rx_tq);
+		taskqueue_start_threads(&sc->sc_rx_tq, 1, PI_NET, "%s rx",
+		    device_get_nameunit(sc->sc_dev));
+	}
 
 	urtwm_radiotap_attach(sc);
 	urtwm_sysctlattach(sc);
@@ -727,6 +914,59 @@ detach:
 	return (ENXIO);			/* failure */
 }
 
+static int
+urtwm_get_tunable(struct urtwm_softc *sc, const char *name, int def,
+    int minval, int maxval)
+{
+	int val;
+
+	if (resource_int_value(device_get_name(sc->sc_dev),
+	    device_get_unit(sc->sc_dev), name, &val) != 0)
+		return (def);
+
+	if (val < minval || val > maxval) {
+		device_printf(sc->sc_dev,
+		    "invalid %s value %d (must be in [%d; %d]), using %d\n",
+		    name, val, minval, maxval, def);
+		return (def);
+	}
+
+	return (val);
+}
+
+static void
+urtwm_hist_add(uint64_t *hist, int shift, u_int val)
+{
+	int i;
+
+	i = fls(val >> shift) - 1;
+	if (i < 0)
+		i = 0;
+	else if (i >= URTWM_RX_HIST_SIZE)
+		i = URTWM_RX_HIST_SIZE - 1;
+
+	hist[i]++;
+}
+
+/* Prints log2 histogram; arg2 is the base (log2). */
+static int
+urtwm_sysctl_hist(SYSCTL_HANDLER_ARGS)
+{
+	uint64_t *hist = arg1;
+	struct sbuf *sb;
+	int error, i;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (i = 0; i < URTWM_RX_HIST_SIZE; i++) {
+		sbuf_printf(sb, "%s%u+:%ju", i == 0 ? "" : " ",
+		    i == 0 ? 0 : 1U << (i + arg2), (uintmax_t)hist[i]);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
 static void
 urtwm_radiotap_attach(struct urtwm_softc *sc)
 {
@@ -741,14 +981,232 @@ urtwm_radiotap_attach(struct urtwm_softc *sc)
 static void
 urtwm_sysctlattach(struct urtwm_softc *sc)
 {
-#ifdef USB_DEBUG
 	struct sysctl_ctx_list *ctx = device_get_sysctl_ctx(sc->sc_dev);
 	struct sysctl_oid *tree = device_get_sysctl_tree(sc->sc_dev);
 
+#ifdef USB_DEBUG
 	SYSCTL_ADD_U32(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
 	    "debug", CTLFLAG_RW, &sc->sc_debug, sc->sc_debug,
 	    "control debugging printfs");
 #endif
+
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_bufs", CTLFLAG_RD, &sc->sc_rx_list_count, 0,
+	    "number of bulk-in transfers in flight (hint.urtwm.N.rx_bufs)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_bufsz", CTLFLAG_RD, &sc->sc_rx_bufsz, 0,
+	    "bulk-in transfer size (hint.urtwm.N.rx_bufsz)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_hist_bytes", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc->sc_rx_hist_bytes, 10, urtwm_sysctl_hist, "A",
+	    "histogram of bytes per bulk-in transfer");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_hist_frames", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc->sc_rx_hist_frames, 0, urtwm_sysctl_hist, "A",
+	    "histogram of frames per bulk-in transfer");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_agg_pin", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_rxagg_pin, "I",
+	    "fixed Rx aggregation profile (-1 - adaptive, "
+	    "0 - lowest latency, up to rx_agg_profile_max)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_agg_profile", CTLFLAG_RD, &sc->sc_rxagg_cur, 0,
+	    "current Rx aggregation profile");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_agg_profile_max", CTLFLAG_RD, &sc->sc_rxagg_max, 0,
+	    "largest Rx aggregation profile that fits into Rx buffer");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_agg_changes", CTLFLAG_RD, &sc->sc_rxagg_changes, 0,
+	    "number of Rx aggregation profile switches");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_xfers", CTLFLAG_RD, &sc->sc_rx_xfers, 0,
+	    "completed bulk-in transfers");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_ring_dry", CTLFLAG_RD, &sc->sc_rx_ring_dry, 0,
+	    "bulk-in completions with no other transfer queued");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_nobufs", CTLFLAG_RD, &sc->sc_rx_nobufs, 0,
+	    "bulk-in transfers not resubmitted due to lack of buffers");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_zerocopy", CTLFLAG_RD, &sc->sc_rx_zerocopy, 0,
+	    "pass received frames without copying "
+	    "(hint.urtwm.N.rx_zerocopy)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_loans", CTLFLAG_RD, &sc->sc_rx_loans, 0,
+	    "bulk-in buffers still referenced by mbufs after processing");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_batches", CTLFLAG_RD, &sc->sc_rx_batches, 0,
+	    "Rx batches passed to net80211 (one unlock per batch)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_batch_frames", CTLFLAG_RD, &sc->sc_rx_batch_frames, 0,
+	    "frames passed to net80211 in all Rx batches");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_batch_max", CTLFLAG_RD, &sc->sc_rx_batch_max, 0,
+	    "largest Rx batch");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_deferred", CTLFLAG_RD, &sc->sc_rx_deferred, 0,
+	    "process received frames in a separate thread "
+	    "(hint.urtwm.N.rx_deferred)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_queue_max", CTLFLAG_RD, &sc->sc_rx_queue_max, 0,
+	    "max number of buffers queued for the Rx thread "
+	    "(hint.urtwm.N.rx_queue_max)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_queue_len", CTLFLAG_RD, &sc->sc_rx_pending_cnt, 0,
+	    "number of buffers queued for the Rx thread");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_queue_drops", CTLFLAG_RD, &sc->sc_rx_queue_drops, 0,
+	    "bulk-in transfers dropped because the Rx thread queue was full");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_node_hits", CTLFLAG_RD, &sc->sc_rx_node_hits, 0,
+	    "Rx node lookups satisfied from the per-transfer cache");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_node_misses", CTLFLAG_RD, &sc->sc_rx_node_misses, 0,
+	    "Rx node lookups done via the node table");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_hwdec", CTLFLAG_RD, &sc->sc_rx_hwdec, 0,
+	    "protected frames decrypted by hardware");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "bcn_filter", CTLFLAG_RD, &sc->sc_bcn_filter, 0,
+	    "max number of unchanged beacons to drop in a row "
+	    "(hint.urtwm.N.bcn_filter)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_bcn_dropped", CTLFLAG_RD, &sc->sc_rx_bcn_dropped, 0,
+	    "unchanged beacons dropped by the beacon filter");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_bcn_keepalive", CTLFLAG_RD, &sc->sc_rx_bcn_keepalive, 0,
+	    "unchanged beacons passed to keep beacon miss detection alive");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_mbufs", CTLFLAG_RD, &sc->sc_rx_mcache_max, 0,
+	    "number of preallocated Rx mbufs (hint.urtwm.N.rx_mbufs)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_mbufs_lowat", CTLFLAG_RD, &sc->sc_rx_mcache_lowat, 0,
+	    "refill the Rx mbuf cache when it drops below this level "
+	    "(hint.urtwm.N.rx_mbufs_lowat)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_mbufs_free", CTLFLAG_RD, &sc->sc_rx_mcache_cnt, 0,
+	    "mbufs currently in the Rx mbuf cache");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_mbufs_hits", CTLFLAG_RD, &sc->sc_rx_mcache_hits, 0,
+	    "Rx mbufs taken from the cache");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_mbufs_misses", CTLFLAG_RD, &sc->sc_rx_mcache_misses, 0,
+	    "Rx mbufs allocated in the callback (cache was empty)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_mbufs_refills", CTLFLAG_RD, &sc->sc_rx_mcache_refills, 0,
+	    "Rx mbuf cache refills");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_tid_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_rx_tid_stats, "A",
+	    "per-TID QoS data frames: passed to A-MPDU reordering / "
+	    "without BA session / received in A-MPDU");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_node_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_rx_node_stats, "A",
+	    "per-node averaged RSSI (dBm) and per-chain RSSI (dBm), "
+	    "SNR and EVM (0.5 dB)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "c2h_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_c2h_stats, "A",
+	    "firmware (C2H) reports received, per event id");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "c2h_inline", CTLFLAG_RD, &sc->sc_c2h_inline, 0,
+	    "C2H reports aggregated behind other frames");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_lro_queued", CTLFLAG_RD, &sc->sc_rx_lro_queued, 0,
+	    "frames passed to LRO");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "rx_lro_flushes", CTLFLAG_RD, &sc->sc_rx_lro_flushes, 0,
+	    "LRO queue flushes");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_agg", CTLFLAG_RD, &sc->sc_tx_agg_max, 0,
+	    "max number of frames per bulk-out transfer "
+	    "(hint.urtwm.N.tx_agg)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_xfers", CTLFLAG_RD, &sc->sc_tx_xfers, 0,
+	    "submitted bulk-out transfers");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_frames", CTLFLAG_RD, &sc->sc_tx_frames, 0,
+	    "frames sent in all bulk-out transfers");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_zcopy", CTLFLAG_RD, &sc->sc_tx_zcopy, 0,
+	    "send contiguous frames from mbuf headroom "
+	    "(hint.urtwm.N.tx_zcopy)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_zcopy_frames", CTLFLAG_RD, &sc->sc_tx_zcopy_frames, 0,
+	    "frames sent without a copy");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_copy_frames", CTLFLAG_RD, &sc->sc_tx_copy_frames, 0,
+	    "frames copied into the transfer buffer");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_copy_bytes", CTLFLAG_RD, &sc->sc_tx_copy_bytes, 0,
+	    "bytes copied into the transfer buffer");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_tmpl_builds", CTLFLAG_RD, &sc->sc_tx_tmpl_builds, 0,
+	    "Tx descriptor template rebuilds");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_sched", CTLFLAG_RD, &sc->sc_tx_sched, 0,
+	    "Tx queue scheduler: 0 - strict priority, 1 - DRR "
+	    "(hint.urtwm.N.tx_sched)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_queue_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_tx_queue_stats, "A",
+	    "per-AC software queue length / max length / drops, "
+	    "buffers in use / reserved and DRR quantum");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_airtime", CTLFLAG_RD, &sc->sc_tx_airtime, 0,
+	    "airtime-fair per-station queues in hostap mode "
+	    "(hint.urtwm.N.tx_airtime)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_airtime_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_tx_airtime_stats, "A",
+	    "per-station queued frames / sent frames / drops, "
+	    "estimated airtime / retry airtime (us)");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_ampdu_adapt", CTLFLAG_RD, &sc->sc_tx_ampdu_adapt, 0,
+	    "adjust A-MPDU length from Tx reports "
+	    "(hint.urtwm.N.tx_ampdu_adapt)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_ampdu_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_tx_ampdu_stats, "A",
+	    "per-node A-MPDU subframe limit / average limit, frames / "
+	    "retries / failures, shrinks / grows");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_bql", CTLFLAG_RD, &sc->sc_tx_bql_on, 0,
+	    "per-AC byte queue limits (hint.urtwm.N.tx_bql, "
+	    "hint.urtwm.N.tx_bql_target - queueing delay target, ms)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_bql_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_tx_bql_stats, "A",
+	    "per-AC byte limit / bytes in flight, average sojourn / "
+	    "chip queue time (us) and throttle events");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_credit", CTLFLAG_RD, &sc->sc_tx_credit, 0,
+	    "hold transfers when the Tx packet buffer is full "
+	    "(hint.urtwm.N.tx_credit)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_page_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_tx_page_stats, "A",
+	    "per hardware queue sampled free / used / in flight pages, "
+	    "public pages, samples and stalls");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_ring_drops", CTLFLAG_RD, &sc->sc_tx_ring_drops,
+	    "frames dropped due to Tx ring overflow");
+	SYSCTL_ADD_COUNTER_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_lock_busy", CTLFLAG_RD, &sc->sc_tx_lock_busy,
+	    "Tx enqueues that found the driver lock busy");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_task_runs", CTLFLAG_RD, &sc->sc_tx_task_runs, 0,
+	    "deferred Tx queue runs");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_depth", CTLFLAG_RD, &sc->sc_tx_depth, 0,
+	    "bulk-out transfers in flight per Tx queue "
+	    "(hint.urtwm.N.tx_depth_{fs,hs,ss})");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+	    "tx_ac_stats", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+	    sc, 0, urtwm_sysctl_tx_ac_stats, "A",
+	    "per-AC bulk-out transfers / frames / bytes and "
+	    "average / max transfer latency (us)");
 }
 
 static int
@@ -763,18 +1221,35 @@ urtwm_detach(device_t self)
 	URTWM_UNLOCK(sc);
 
 	callout_drain(&sc->sc_calib_to);
+	callout_drain(&sc->sc_rxagg_to);
+	callout_drain(&sc->sc_tx_pg_to);
 
 	urtwm_stop(sc);
 
 	/* stop all USB transfers */
 	usbd_transfer_unsetup(sc->sc_xfer, URTWM_N_TRANSFER);
 
+	if (sc->sc_rx_tq != NULL) {
+		taskqueue_drain(sc->sc_rx_tq, &sc->sc_rx_task);
+		taskqueue_free(sc->sc_rx_tq);
+	}
+	taskqueue_drain(taskqueue_thread, &sc->sc_rx_mcache_task);
+	urtwm_rx_mcache_free(sc);
+
 	if (ic->ic_softc == sc) {
 		callout_drain(&sc->sc_pwrmode_init);
 		ieee80211_draintask(ic, &sc->cmdq_task);
+		ieee80211_draintask(ic, &sc->sc_rx_ext_task);
+		ieee80211_draintask(ic, &sc->sc_tx_task);
 		ieee80211_ifdetach(ic);
 	}
 
+	if (sc->sc_tx_ring != NULL) {
+		buf_ring_free(sc->sc_tx_ring, M_DEVBUF);
+		counter_u64_free(sc->sc_tx_ring_drops);
+		counter_u64_free(sc->sc_tx_lock_busy);
+	}
+
 	URTWM_NT_LOCK_DESTROY(sc);
 	URTWM_CMDQ_LOCK_DESTROY(sc);
 	mtx_destroy(&sc->sc_mtx);
@@ -787,13 +1262,23 @@ urtwm_drain_mbufq(struct urtwm_softc *sc)
 {
 	struct mbuf *m;
 	struct ieee80211_node *ni;
+	int i;
 	URTWM_ASSERT_LOCKED(sc);
-	while ((m = mbufq_dequeue(&sc->sc_snd)) != NULL) {
+	while ((m = buf_ring_dequeue_sc(sc->sc_tx_ring)) != NULL) {
 		ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
 		m->m_pkthdr.rcvif = NULL;
 		ieee80211_free_node(ni);
 		m_freem(m);
 	}
+	for (i = 0; i < WME_NUM_AC; i++) {
+		while ((m = mbufq_dequeue(&sc->sc_snd[i])) != NULL) {
+			ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
+			m->m_pkthdr.rcvif = NULL;
+			ieee80211_free_node(ni);
+			m_freem(m);
+		}
+	}
+	urtwm_tx_nq_flush(sc, NULL);
 }
 
 static usb_error_t
@@ -975,11 +1460,19 @@ urtwm_vap_create(struct ieee80211com *ic, const char name[IFNAMSIZ], int unit,
 
 	ifp = vap->iv_ifp;
 	ifp->if_capabilities = IFCAP_RXCSUM | IFCAP_RXCSUM_IPV6;
+#if defined(INET) || defined(INET6)
+	if (tcp_lro_init(&uvp->lro) == 0) {
+		uvp->lro.ifp = ifp;
+		ifp->if_capabilities |= IFCAP_LRO;
+	}
+#endif
 	URTWM_LOCK(sc);
 	if (sc->sc_flags & URTWM_RXCKSUM_EN)
 		ifp->if_capenable |= IFCAP_RXCSUM;
 	if (sc->sc_flags & URTWM_RXCKSUM6_EN)
 		ifp->if_capenable |= IFCAP_RXCSUM_IPV6;
+	if (sc->sc_flags & URTWM_RXLRO_EN)
+		ifp->if_capenable |= ifp->if_capabilities & IFCAP_LRO;
 	URTWM_UNLOCK(sc);
 
 	urtwm_init_beacon(sc, uvp);
@@ -1014,6 +1507,10 @@ urtwm_vap_create(struct ieee80211com *ic, const char name[IFNAMSIZ], int unit,
 	ieee80211_vap_attach(vap, ieee80211_media_change,
 	    ieee80211_media_status, mac);
 
+	/* Intercept decapsulated frames (for LRO). */
+	uvp->if_input = ifp->if_input;
+	ifp->if_input = urtwm_vap_input;
+
 	URTWM_LOCK(sc);
 	urtwm_set_ic_opmode(sc);
 	if (sc->sc_flags & URTWM_RUNNING) {
@@ -1060,17 +1557,37 @@ urtwm_vap_delete(struct ieee80211vap *vap)
 
 	ieee80211_ratectl_deinit(vap);
 	ieee80211_vap_detach(vap);
+#if defined(INET) || defined(INET6)
+	if (uvp->lro.ifp != NULL)
+		tcp_lro_free(&uvp->lro);
+#endif
 	free(uvp, M_80211_VAP);
 }
 
 static void
 urtwm_vap_clear_tx(struct urtwm_softc *sc, struct ieee80211vap *vap)
 {
+	struct urtwm_data *dp;
+	int i;
 
 	URTWM_ASSERT_LOCKED(sc);
 
-	urtwm_vap_clear_tx_queue(sc, &sc->sc_tx_active, vap);
-	urtwm_vap_clear_tx_queue(sc, &sc->sc_tx_pending, vap);
+	/* NB: buffers will be returned by urtwm_bulk_tx_callback(). */
+	STAILQ_FOREACH(dp, &sc->sc_tx_active, next) {
+		if (dp->ni != NULL && dp->ni->ni_vap == vap) {
+			if (dp->txbuf != dp->buf) {
+				/* The mbuf is still in use by the transfer. */
+				ieee80211_free_node(dp->ni);
+				dp->ni = NULL;
+			} else
+				urtwm_tx_free_frames(dp);
+		}
+	}
+
+	for (i = 0; i < WME_NUM_AC; i++)
+		urtwm_vap_clear_tx_queue(sc, &sc->sc_tx_pending[i], vap);
+
+	urtwm_tx_nq_flush(sc, vap);
 }
 
 static void
@@ -1081,18 +1598,15 @@ urtwm_vap_clear_tx_queue(struct urtwm_softc *sc, urtwm_datahead *head,
 
 	STAILQ_FOREACH_SAFE(dp, head, next, tmp) {
 		if (dp->ni != NULL) {
+			/* NB: aggregated frames belong to the same vap. */
 			if (dp->ni->ni_vap == vap) {
-				ieee80211_free_node(dp->ni);
-				dp->ni = NULL;
-
-				if (dp->m != NULL) {
-					m_freem(dp->m);
-					dp->m = NULL;
-				}
+				urtwm_tx_free_frames(dp);
+				urtwm_tx_bql_complete(sc, dp, 0);
 
 				STAILQ_REMOVE(head, dp, urtwm_data, next);
 				STAILQ_INSERT_TAIL(&sc->sc_tx_inactive, dp,
 				    next);
+				sc->sc_tx_nbufs[URTWM_TX_QIDX(dp->qid)]--;
 			}
 		}
 	}
@@ -1117,9 +1631,217 @@ urtwm_ff_flush_all(struct urtwm_softc *sc, union sec_param *data)
 }
 #endif
 
+static void
+urtwm_rx_ext_free(struct mbuf *m)
+{
+	struct urtwm_rx_ext *ext = m->m_ext.ext_arg2;
+	struct urtwm_softc *sc;
+
+	mtx_lock(&urtwm_rx_ext_mtx);
+	sc = ext->sc;
+	if (sc == NULL) {
+		/* The device is gone; nobody else will use this buffer. */
+		free(m->m_ext.ext_buf, M_USBDEV);
+		urtwm_rx_orphans--;
+	} else {
+		ext->returned = 1;
+		ieee80211_runtask(&sc->sc_ic, &sc->sc_rx_ext_task);
+	}
+	mtx_unlock(&urtwm_rx_ext_mtx);
+}
+
+static void
+urtwm_rx_ext_task(void *arg, int pending)
+{
+	struct urtwm_softc *sc = arg;
+	struct urtwm_data *data, *tmp;
+
+	URTWM_LOCK(sc);
+	mtx_lock(&urtwm_rx_ext_mtx);
+	STAILQ_FOREACH_SAFE(data, &sc->sc_rx_loaned, next, tmp) {
+		if (!data->ext->returned)
+			continue;
+
+		data->ext->returned = 0;
+		STAILQ_REMOVE(&sc->sc_rx_loaned, data, urtwm_data, next);
+		STAILQ_INSERT_TAIL(&sc->sc_rx_inactive, data, next);
+	}
+	mtx_unlock(&urtwm_rx_ext_mtx);
+
+	/* Restart transfers that were stopped due to lack of buffers. */
+	if (sc->sc_flags & URTWM_RUNNING)
+		urtwm_rx_start(sc);
+	URTWM_UNLOCK(sc);
+}
+
+/*
+ * Takes an mbuf from the preallocated cache (falls back to
+ * m_get2() if it is empty or if the frame does not fit).
+ */
+static struct mbuf *
+urtwm_rx_mcache_get(struct urtwm_softc *sc, int totlen)
+{
+	struct mbuf *m;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	if (__predict_true(sc->sc_rx_mcache != NULL &&
+	    totlen <= URTWM_RX_MCACHE_BUFSZ)) {
+		m = sc->sc_rx_mcache;
+		sc->sc_rx_mcache = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		sc->sc_rx_mcache_cnt--;
+		sc->sc_rx_mcache_hits++;
+	} else {
+		m = NULL;
+		if (sc->sc_rx_mcache_max != 0)
+			sc->sc_rx_mcache_misses++;
+	}
+
+	if (sc->sc_rx_mcache_cnt <= sc->sc_rx_mcache_lowat &&
+	    sc->sc_rx_mcache_max != 0 && !sc->sc_rx_mcache_refill) {
+		sc->sc_rx_mcache_refill = 1;
+		taskqueue_enqueue(taskqueue_thread, &sc->sc_rx_mcache_task);
+	}
+
+	if (m == NULL)
+		m = m_get2(totlen, M_NOWAIT, MT_DATA, M_PKTHDR);
+
+	return (m);
+}
+
+static void
+urtwm_rx_mcache_task(void *arg, int pending)
+{
+	struct urtwm_softc *sc = arg;
+	struct mbuf *head, *m;
+	int i, n;
+
+	URTWM_LOCK(sc);
+	n = sc->sc_rx_mcache_max - sc->sc_rx_mcache_cnt;
+	URTWM_UNLOCK(sc);
+
+	/* NB: sleep (if needed) without holding the lock. */
+	head = NULL;
+	for (i = 0; i < n; i++) {
+		m = m_getcl(M_WAITOK, MT_DATA, M_PKTHDR);
+		m->m_nextpkt = head;
+		head = m;
+	}
+
+	URTWM_LOCK(sc);
+	while (head != NULL &&
+	    sc->sc_rx_mcache_cnt < sc->sc_rx_mcache_max) {
+		m = head;
+		head = m->m_nextpkt;
+		m->m_nextpkt = sc->sc_rx_mcache;
+		sc->sc_rx_mcache = m;
+		sc->sc_rx_mcache_cnt++;
+	}
+	sc->sc_rx_mcache_refill = 0;
+	sc->sc_rx_mcache_refills++;
+	URTWM_UNLOCK(sc);
+
+	while ((m = head) != NULL) {
+		head = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		m_freem(m);
+	}
+}
+
+static void
+urtwm_rx_mcache_free(struct urtwm_softc *sc)
+{
+	struct mbuf *m;
+
+	while ((m = sc->sc_rx_mcache) != NULL) {
+		sc->sc_rx_mcache = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		m_freem(m);
+	}
+	sc->sc_rx_mcache_cnt = 0;
+}
+
+/*
+ * Returns non-zero if the frame is a beacon from our BSS which content
+ * (except for timestamp and DTIM count) was not changed since the last
+ * one; every bcn_skip_max + 1 beacon is passed anyway, so net80211
+ * software beacon miss handling will not be triggered.
+ */
+static int
+urtwm_rx_bcn_filter(struct urtwm_softc *sc, const struct ieee80211_frame *wh,
+    int pktlen)
+{
+	struct urtwm_vap *uvp;
+	const uint8_t *frm, *efrm, *tim;
+	uint32_t hash;
+	int i;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	if ((wh->i_fc[0] & (IEEE80211_FC0_TYPE_MASK |
+	    IEEE80211_FC0_SUBTYPE_MASK)) !=
+	    (IEEE80211_FC0_TYPE_MGT | IEEE80211_FC0_SUBTYPE_BEACON))
+		return (0);
+
+	/* Header, timestamp, beacon interval and capability info. */
+	if (pktlen < sizeof(*wh) + 12)
+		return (0);
+
+	uvp = NULL;
+	for (i = 0; i < nitems(sc->vaps); i++) {
+		if (sc->vaps[i] != NULL && sc->vaps[i]->bcn_skip_max != 0 &&
+		    IEEE80211_ADDR_EQ(wh->i_addr3, sc->vaps[i]->bcn_bssid)) {
+			uvp = sc->vaps[i];
+			break;
+		}
+	}
+	if (uvp == NULL)
+		return (0);
+
+	/* Skip timestamp. */
+	frm = (const uint8_t *)&wh[1] + 8;
+	efrm = (const uint8_t *)wh + pktlen;
+
+	/* Find TIM element (DTIM count is changed with every beacon). */
+	for (tim = frm + 4; tim + 2 <= efrm; tim += 2 + tim[1]) {
+		/* Let net80211 deal with malformed frames. */
+		if (tim + 2 + tim[1] > efrm)
+			return (0);
+		if (tim[0] == IEEE80211_ELEMID_TIM)
+			break;
+	}
+	if (tim + 2 > efrm)
+		tim = NULL;
+
+	if (tim != NULL && tim[1] != 0) {
+		hash = hash32_buf(frm, tim + 2 - frm, HASHINIT);
+		hash = hash32_buf(tim + 3, efrm - tim - 3, hash);
+	} else
+		hash = hash32_buf(frm, efrm - frm, HASHINIT);
+
+	if (!uvp->bcn_hash_valid || uvp->bcn_hash != hash) {
+		uvp->bcn_hash = hash;
+		uvp->bcn_hash_valid = 1;
+		uvp->bcn_skip = 0;
+		return (0);
+	}
+
+	if (uvp->bcn_skip >= uvp->bcn_skip_max) {
+		uvp->bcn_skip = 0;
+		sc->sc_rx_bcn_keepalive++;
+		return (0);
+	}
+
+	uvp->bcn_skip++;
+	sc->sc_rx_bcn_dropped++;
+
+	return (1);
+}
+
 static struct mbuf *
-urtwm_rx_copy_to_mbuf(struct urtwm_softc *sc, struct r92c_rx_stat *stat,
-    int totlen)
+urtwm_rx_copy_to_mbuf(struct urtwm_softc *sc, struct urtwm_data *data,
+    struct r92c_rx_stat *stat, int totlen)
 {
 	struct ieee80211com *ic = &sc->sc_ic;
 	struct mbuf *m;
@@ -1157,7 +1879,22 @@ urtwm_rx_copy_to_mbuf(struct urtwm_softc *sc, struct r92c_rx_stat *stat,
 		goto fail;
 	}
 
-	m = m_get2(totlen, M_NOWAIT, MT_DATA, M_PKTHDR);
+	if (sc->sc_bcn_filter != 0 &&
+	    urtwm_rx_bcn_filter(sc, (const struct ieee80211_frame *)
+	    ((uint8_t *)&stat[1] + MS(rxdw0, R92C_RXDW0_INFOSZ) * 8), pktlen))
+		return (NULL);
+
+	if (sc->sc_rx_zerocopy) {
+		/* Point the mbuf to the frame inside of Rx buffer. */
+		m = m_gethdr(M_NOWAIT, MT_DATA);
+		if (__predict_true(m != NULL)) {
+			m_extaddref(m, data->buf, sc->sc_rx_bufsz,
+			    &data->ext->refs, urtwm_rx_ext_free, sc,
+			    data->ext);
+			m->m_data = (caddr_t)stat;
+		}
+	} else
+		m = urtwm_rx_mcache_get(sc, totlen);
 	if (__predict_false(m == NULL)) {
 		device_printf(sc->sc_dev, "%s: could not allocate RX mbuf\n",
 		    __func__);
@@ -1165,7 +1902,8 @@ urtwm_rx_copy_to_mbuf(struct urtwm_softc *sc, struct r92c_rx_stat *stat,
 	}
 
 	/* Finalize mbuf. */
-	memcpy(mtod(m, uint8_t *), (uint8_t *)stat, totlen);
+	if (!sc->sc_rx_zerocopy)
+		memcpy(mtod(m, uint8_t *), (uint8_t *)stat, totlen);
 	m->m_pkthdr.len = m->m_len = totlen;
 
 	rxdw1 = le32toh(stat->rxdw1);
@@ -1197,32 +1935,17 @@ fail:
 }
 
 static struct mbuf *
-urtwm_report_intr(struct urtwm_softc *sc, struct usb_xfer *xfer,
-    struct urtwm_data *data)
+urtwm_report_intr(struct urtwm_softc *sc, struct urtwm_data *data, int len)
 {
 	struct ieee80211com *ic = &sc->sc_ic;
-	struct r92c_rx_stat *stat;
-	uint8_t *buf;
-	uint32_t rxdw2;
-	int len;
 
-	usbd_xfer_status(xfer, &len, NULL, NULL, NULL);
-
-	if (__predict_false(len < sizeof(*stat))) {
+	if (__predict_false(len < sizeof(struct r92c_rx_stat))) {
 		counter_u64_add(ic->ic_ierrors, 1);
 		return (NULL);
 	}
 
-	buf = data->buf;
-	stat = (struct r92c_rx_stat *)buf;
-	rxdw2 = le32toh(stat->rxdw2);
-
-	if (rxdw2 & R12A_RXDW2_RPT_C2H)
-		urtwm_c2h_report(sc, (uint8_t *)&stat[1], len - sizeof(*stat));
-	else
-		return (urtwm_rxeof(sc, buf, len));
-
-	return (NULL);
+	/* NB: C2H reports are handled in urtwm_rxeof(). */
+	return (urtwm_rxeof(sc, data, data->buf, len));
 }
 
 static void
@@ -1236,10 +1959,33 @@ urtwm_c2h_report(struct urtwm_softc *sc, uint8_t *buf, int len)
 	}
 	len -= 2;
 
+	sc->sc_c2h_events[imin(buf[0], URTWM_C2H_NTYPES - 1)]++;
+
 	switch (buf[0]) {	/* command id */
 	case R12A_C2H_TX_REPORT:
+		if (len >= sizeof(struct r12a_c2h_tx_rpt)) {
+			urtwm_tx_bql_report(sc,
+			    (struct r12a_c2h_tx_rpt *)&buf[2]);
+		}
 		urtwm_ratectl_tx_complete(sc, &buf[2], len);
 		break;
+	case R12A_C2H_RA_REPORT:
+	{
+		struct r12a_c2h_ra_report *rpt =
+		    (struct r12a_c2h_ra_report *)&buf[2];
+
+		if (len < sizeof(*rpt))
+			break;
+
+		URTWM_DPRINTF(sc, URTWM_DEBUG_RA,
+		    "%s: macid %u, rate index %u\n", __func__, rpt->macid,
+		    MS(rpt->rarptb0, R12A_RARPTB0_RATE));
+		break;
+	}
+	case R12A_C2H_DEBUG:
+	case R12A_C2H_BT_INFO:
+		/* Ignore. */
+		break;
 	case R12A_C2H_IQK_FINISHED:
 		URTWM_DPRINTF(sc, URTWM_DEBUG_CALIB,
 		    "FW IQ calibration finished\n");
@@ -1287,6 +2033,8 @@ urtwm_ratectl_tx_complete(struct urtwm_softc *sc, void *buf, int len)
 		    "%s sent (%d retries)\n", __func__, rpt->macid,
 		    (rpt->txrptb0 & (R12A_TXRPTB0_RETRY_OVER |
 		    R12A_TXRPTB0_LIFE_EXPIRE)) ? " not" : "", ntries);
+		urtwm_tx_airtime_report(sc, ni, rpt, ntries);
+		urtwm_tx_ampdu_report(sc, ni, rpt, ntries);
 #if __FreeBSD_version >= 1200012
 		txs.flags = IEEE80211_RATECTL_STATUS_LONG_RETRY |
 			    IEEE80211_RATECTL_STATUS_FINAL_RATE;
@@ -1323,14 +2071,19 @@ urtwm_ratectl_tx_complete(struct urtwm_softc *sc, void *buf, int len)
 }
 
 static struct mbuf *
-urtwm_rxeof(struct urtwm_softc *sc, uint8_t *buf, int len)
+urtwm_rxeof(struct urtwm_softc *sc, struct urtwm_data *data, uint8_t *buf,
+    int len)
 {
 	struct r92c_rx_stat *stat;
 	struct mbuf *m, *m0 = NULL;
-	uint32_t rxdw0;
-	int totlen, pktlen, infosz;
+	uint32_t rxdw0, rxdw2;
+	int totlen, pktlen, infosz, nframes;
+
+	urtwm_hist_add(sc->sc_rx_hist_bytes, 10, len);
+	sc->sc_rx_bytes += len;
 
 	/* Process packets. */
+	nframes = 0;
 	while (len >= sizeof(*stat)) {
 		stat = (struct r92c_rx_stat *)buf;
 		rxdw0 = le32toh(stat->rxdw0);
@@ -1346,10 +2099,20 @@ urtwm_rxeof(struct urtwm_softc *sc, uint8_t *buf, int len)
 		if (totlen > len)
 			break;
 
-		if (m0 == NULL)
-			m0 = m = urtwm_rx_copy_to_mbuf(sc, stat, totlen);
-		else {
-			m->m_next = urtwm_rx_copy_to_mbuf(sc, stat, totlen);
+		/* C2H reports may be aggregated with data frames too. */
+		rxdw2 = le32toh(stat->rxdw2);
+		if (rxdw2 & R12A_RXDW2_RPT_C2H) {
+			if (buf != data->buf)
+				sc->sc_c2h_inline++;
+			urtwm_c2h_report(sc, (uint8_t *)&stat[1] + infosz,
+			    pktlen);
+		} else if (m0 == NULL) {
+			nframes++;
+			m0 = m = urtwm_rx_copy_to_mbuf(sc, data, stat, totlen);
+		} else {
+			nframes++;
+			m->m_next = urtwm_rx_copy_to_mbuf(sc, data, stat,
+			    totlen);
 			if (m->m_next != NULL)
 				m = m->m_next;
 		}
@@ -1361,73 +2124,515 @@ urtwm_rxeof(struct urtwm_softc *sc, uint8_t *buf, int len)
 		len -= totlen;
 	}
 
+	urtwm_hist_add(sc->sc_rx_hist_frames, 0, nframes);
+
 	return (m0);
 }
 
+/*
+ * Returns a node for the frame; the reference is owned by the frame
+ * if URTWM_RX_NODE_REF() is set (see urtwm_rx_deliver()).
+ */
 static struct ieee80211_node *
-urtwm_rx_frame(struct urtwm_softc *sc, struct mbuf *m, int8_t *rssi)
+urtwm_rx_node_lookup(struct urtwm_softc *sc, struct urtwm_rx_node_cache *nc,
+    struct mbuf *m, const struct ieee80211_frame_min *wh)
 {
-	struct ieee80211com *ic = &sc->sc_ic;
 	struct ieee80211_node *ni;
-	struct ieee80211_frame_min *wh;
-	struct urtwm_node *un;
-	struct r92c_rx_stat *stat;
-	uint32_t rxdw0, rxdw3;
-	uint8_t rate, cipher;
-	int infosz;
 
-	stat = mtod(m, struct r92c_rx_stat *);
-	rxdw0 = le32toh(stat->rxdw0);
-	rxdw3 = le32toh(stat->rxdw3);
+	/* Control frames may have no transmitter address. */
+	if ((wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK) ==
+	    IEEE80211_FC0_TYPE_CTL) {
+		URTWM_RX_NODE_REF(m) = 1;
+		return (ieee80211_find_rxnode(&sc->sc_ic, wh));
+	}
 
-	rate = MS(rxdw3, R92C_RXDW3_RATE);
-	cipher = MS(rxdw0, R92C_RXDW0_CIPHER);
-	infosz = MS(rxdw0, R92C_RXDW0_INFOSZ) * 8;
+	/* NB: ni_table is cleared when the node leaves. */
+	if (nc->ni != NULL && nc->ni->ni_table != NULL &&
+	    IEEE80211_ADDR_EQ(nc->macaddr, wh->i_addr2)) {
+		sc->sc_rx_node_hits++;
+		nc->last = m;
+		return (nc->ni);
+	}
 
-	wh = (struct ieee80211_frame_min *)(mtod(m, uint8_t *) +
-	    sizeof(*stat) + infosz);
-	if ((wh->i_fc[1] & IEEE80211_FC1_PROTECTED) &&
-	    cipher != R92C_CAM_ALGO_NONE)
-		m->m_flags |= M_WEP;
+	sc->sc_rx_node_misses++;
+	ni = ieee80211_find_rxnode(&sc->sc_ic, wh);
+	if (ni == NULL)
+		return (NULL);
 
-	if (m->m_len >= sizeof(*wh))
-		ni = ieee80211_find_rxnode(ic, wh);
-	else
-		ni = NULL;
-	un = URTWM_NODE(ni);
+	/* Pass previous reference to the last frame which used it. */
+	if (nc->ni != NULL)
+		URTWM_RX_NODE_REF(nc->last) = 1;
 
-	/* Get RSSI from PHY status descriptor if present. */
-	if (infosz != 0 && (rxdw0 & R92C_RXDW0_PHYST)) {
-		*rssi = urtwm_get_rssi(sc, rate, &stat[1]);
-		URTWM_DPRINTF(sc, URTWM_DEBUG_RSSI, "%s: rssi=%d\n", __func__,
-		    *rssi);
+	nc->ni = ni;
+	nc->last = m;
+	IEEE80211_ADDR_COPY(nc->macaddr, wh->i_addr2);
 
-		sc->last_rssi = *rssi;
-		if (un != NULL)
-			un->last_rssi = *rssi;
-	} else
-		*rssi = (un != NULL) ? un->last_rssi : sc->last_rssi;
+	return (ni);
+}
 
-	if (ieee80211_radiotap_active(ic)) {
-		struct urtwm_rx_radiotap_header *tap = &sc->sc_rxtap;
-		int id = URTWM_VAP_ID_INVALID;
+/*
+ * Only frames from an active BA session need to go through
+ * net80211 reordering; this includes non-aggregated ones
+ * (otherwise they will be passed up out of order).
+ */
+static void
+urtwm_rx_ampdu_check(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    struct mbuf *m, const struct ieee80211_frame *wh, uint32_t rxdw1)
+{
+	struct urtwm_rx_tid_stats *stats;
+	uint8_t tid;
 
-		tap->wr_flags = 0;
-		if (le32toh(stat->rxdw4) & R92C_RXDW4_SGI)
-			tap->wr_flags |= IEEE80211_RADIOTAP_F_SHORTGI;
+	if (!(ni->ni_flags & IEEE80211_NODE_HT) ||
+	    !IEEE80211_QOS_HAS_SEQ(wh) ||
+	    IEEE80211_IS_MULTICAST(wh->i_addr1))
+		return;
 
-		if (ni != NULL)
-			id = URTWM_VAP(ni->ni_vap)->id;
-		if (id == URTWM_VAP_ID_INVALID)
-			id = 0;
+	/* NB: QoS field of 4-address frames may be past the checked length. */
+	tid = MS(rxdw1, R12A_RXDW1_TID);
+	stats = &sc->sc_rx_tid[tid];
+	if (rxdw1 & R12A_RXDW1_PAGGR)
+		stats->paggr++;
 
-		tap->wr_tsft = urtwm_get_tsf_high(sc, id);
-		if (le32toh(stat->rxdw5) > urtwm_get_tsf_low(sc, id))
-			tap->wr_tsft--;
-		tap->wr_tsft = (uint64_t)htole32(tap->wr_tsft) << 32;
-		tap->wr_tsft += stat->rxdw5;
+	if (ni->ni_rx_ampdu[tid].rxa_flags & IEEE80211_AGGR_RUNNING) {
+		m->m_flags |= M_AMPDU;
+		stats->reorder++;
+	} else
+		stats->bypass++;
+}
 
-		/* XXX 20/40? */
+static int
+urtwm_sysctl_rx_tid_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct urtwm_softc *sc = arg1;
+	struct urtwm_rx_tid_stats *stats;
+	struct sbuf *sb;
+	int error, i;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < WME_NUM_TID; i++) {
+		stats = &sc->sc_rx_tid[i];
+		if (stats->reorder == 0 && stats->bypass == 0)
+			continue;
+
+		sbuf_printf(sb, "\ntid %d: %ju / %ju / %ju", i,
+		    (uintmax_t)stats->reorder, (uintmax_t)stats->bypass,
+		    (uintmax_t)stats->paggr);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_rx_node_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct urtwm_softc *sc = arg1;
+	struct urtwm_node_rxstats *stats, *rs;
+	struct ieee80211_node *ni;
+	struct sbuf *sb;
+	uint8_t (*macaddr)[IEEE80211_ADDR_LEN];
+	int error, i, id, n;
+
+	/* NB: sbuf drain may sleep; take a snapshot first. */
+	stats = malloc((URTWM_MACID_MAX(sc) + 1) * sizeof(*stats),
+	    M_TEMP, M_WAITOK);
+	macaddr = malloc((URTWM_MACID_MAX(sc) + 1) * sizeof(*macaddr),
+	    M_TEMP, M_WAITOK);
+
+	n = 0;
+	URTWM_LOCK(sc);
+	URTWM_NT_LOCK(sc);
+	for (id = 0; id <= URTWM_MACID_MAX(sc); id++) {
+		ni = sc->node_list[id];
+		if (ni == NULL || URTWM_NODE(ni)->rxstats.nsamples == 0)
+			continue;
+
+		stats[n] = URTWM_NODE(ni)->rxstats;
+		IEEE80211_ADDR_COPY(macaddr[n], ni->ni_macaddr);
+		n++;
+	}
+	URTWM_NT_UNLOCK(sc);
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (id = 0; id < n; id++) {
+		rs = &stats[id];
+		sbuf_printf(sb, "\n%6D: rssi %d", macaddr[id], ":",
+		    URTWM_EWMA_GET(rs->rssi));
+		if (rs->nsamples_ofdm == 0)
+			continue;
+
+		for (i = 0; i < sc->nrxchains; i++) {
+			sbuf_printf(sb, " [%d: %d / %d / %d]", i,
+			    URTWM_EWMA_GET(rs->chain[i].rssi),
+			    URTWM_EWMA_GET(rs->chain[i].snr),
+			    URTWM_EWMA_GET(rs->chain[i].evm));
+		}
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	free(macaddr, M_TEMP);
+	free(stats, M_TEMP);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_c2h_stats(SYSCTL_HANDLER_ARGS)
+{
+	static const char *names[URTWM_C2H_NTYPES] = {
+		[R12A_C2H_DEBUG]	= "debug",
+		[R12A_C2H_TX_REPORT]	= "tx report",
+		[R12A_C2H_BT_INFO]	= "bt info",
+		[R12A_C2H_RA_REPORT]	= "ra report",
+		[R12A_C2H_IQK_FINISHED]	= "iqk finished",
+		[URTWM_C2H_NTYPES - 1]	= "other"
+	};
+	struct urtwm_softc *sc = arg1;
+	struct sbuf *sb;
+	int error, i;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < URTWM_C2H_NTYPES; i++) {
+		if (sc->sc_c2h_events[i] == 0)
+			continue;
+
+		sbuf_printf(sb, "\n0x%02x (%s): %ju", i,
+		    names[i] != NULL ? names[i] : "unknown",
+		    (uintmax_t)sc->sc_c2h_events[i]);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_tx_ac_stats(SYSCTL_HANDLER_ARGS)
+{
+	static const char *names[WME_NUM_AC] = { "BE", "BK", "VI", "VO" };
+	struct urtwm_softc *sc = arg1;
+	struct urtwm_tx_ac_stats stats[WME_NUM_AC];
+	struct sbuf *sb;
+	int error, i;
+
+	URTWM_LOCK(sc);
+	memcpy(stats, sc->sc_tx_ac, sizeof(stats));
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		sbuf_printf(sb, "\n%s: %ju / %ju / %ju, %jd / %jd", names[i],
+		    (uintmax_t)stats[i].xfers, (uintmax_t)stats[i].frames,
+		    (uintmax_t)stats[i].bytes,
+		    (intmax_t)(stats[i].xfers != 0 ?
+		    sbttous(stats[i].lat_sum / stats[i].xfers) : 0),
+		    (intmax_t)sbttous(stats[i].lat_max));
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_tx_queue_stats(SYSCTL_HANDLER_ARGS)
+{
+	static const char *names[WME_NUM_AC] = { "BE", "BK", "VI", "VO" };
+	struct urtwm_softc *sc = arg1;
+	struct sbuf *sb;
+	uint64_t drops[WME_NUM_AC];
+	int qlen[WME_NUM_AC], qlen_max[WME_NUM_AC];
+	int nbufs[WME_NUM_AC];
+	int error, i;
+
+	URTWM_LOCK(sc);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		qlen[i] = urtwm_tx_ac_len(sc, i);
+		qlen_max[i] = sc->sc_tx_ac[i].qlen_max;
+		drops[i] = sc->sc_tx_ac[i].drops;
+		nbufs[i] = sc->sc_tx_nbufs[i];
+	}
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		sbuf_printf(sb, "\n%s: %d / %d / %ju, %d / %d, %d", names[i],
+		    qlen[i], qlen_max[i], (uintmax_t)drops[i], nbufs[i],
+		    sc->sc_tx_resv[i], sc->sc_tx_quantum[i]);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_tx_airtime_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct urtwm_softc *sc = arg1;
+	struct urtwm_node *un;
+	struct sbuf *sb;
+	struct {
+		uint8_t		macaddr[IEEE80211_ADDR_LEN];
+		int		qlen;
+		uint64_t	frames;
+		uint64_t	drops;
+		uint64_t	airtime;
+		uint64_t	airtime_retry;
+	} *stats, *st;
+	int error, i, id, n;
+
+	/* NB: sbuf drain may sleep; take a snapshot first. */
+	stats = malloc((URTWM_MACID_MAX(sc) + 1) * sizeof(*stats),
+	    M_TEMP, M_WAITOK);
+
+	n = 0;
+	URTWM_LOCK(sc);
+	URTWM_NT_LOCK(sc);
+	for (id = 0; id <= URTWM_MACID_MAX(sc); id++) {
+		un = URTWM_NODE(sc->node_list[id]);
+		if (un == NULL || (un->tx_frames == 0 && un->tx_drops == 0))
+			continue;
+
+		st = &stats[n++];
+		IEEE80211_ADDR_COPY(st->macaddr, un->ni.ni_macaddr);
+		st->qlen = 0;
+		for (i = 0; i < WME_NUM_AC; i++)
+			st->qlen += mbufq_len(&un->tx_q[i]);
+		st->frames = un->tx_frames;
+		st->drops = un->tx_drops;
+		st->airtime = un->tx_airtime;
+		st->airtime_retry = un->tx_airtime_retry;
+	}
+	URTWM_NT_UNLOCK(sc);
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (id = 0; id < n; id++) {
+		st = &stats[id];
+		sbuf_printf(sb, "\n%6D: %d / %ju / %ju, %ju / %ju",
+		    st->macaddr, ":", st->qlen, (uintmax_t)st->frames,
+		    (uintmax_t)st->drops, (uintmax_t)st->airtime,
+		    (uintmax_t)st->airtime_retry);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	free(stats, M_TEMP);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_tx_ampdu_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct urtwm_softc *sc = arg1;
+	struct urtwm_node *un;
+	struct sbuf *sb;
+	struct {
+		uint8_t		macaddr[IEEE80211_ADDR_LEN];
+		int		limit;
+		uint64_t	frames;
+		uint64_t	limit_sum;
+		uint64_t	retries;
+		uint64_t	fails;
+		uint64_t	shrinks;
+		uint64_t	grows;
+	} *stats, *st;
+	int error, id, n;
+
+	/* NB: sbuf drain may sleep; take a snapshot first. */
+	stats = malloc((URTWM_MACID_MAX(sc) + 1) * sizeof(*stats),
+	    M_TEMP, M_WAITOK);
+
+	n = 0;
+	URTWM_LOCK(sc);
+	URTWM_NT_LOCK(sc);
+	for (id = 0; id <= URTWM_MACID_MAX(sc); id++) {
+		un = URTWM_NODE(sc->node_list[id]);
+		if (un == NULL || un->agg_frames == 0)
+			continue;
+
+		st = &stats[n++];
+		IEEE80211_ADDR_COPY(st->macaddr, un->ni.ni_macaddr);
+		st->limit = un->agg_limit;
+		st->frames = un->agg_frames;
+		st->limit_sum = un->agg_limit_sum;
+		st->retries = un->agg_retries;
+		st->fails = un->agg_fails;
+		st->shrinks = un->agg_shrinks;
+		st->grows = un->agg_grows;
+	}
+	URTWM_NT_UNLOCK(sc);
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (id = 0; id < n; id++) {
+		st = &stats[id];
+		sbuf_printf(sb, "\n%6D: %d / %ju, %ju / %ju / %ju, %ju / %ju",
+		    st->macaddr, ":", st->limit,
+		    (uintmax_t)(st->limit_sum / st->frames),
+		    (uintmax_t)st->frames, (uintmax_t)st->retries,
+		    (uintmax_t)st->fails, (uintmax_t)st->shrinks,
+		    (uintmax_t)st->grows);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	free(stats, M_TEMP);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_tx_page_stats(SYSCTL_HANDLER_ARGS)
+{
+	static const char *names[URTWM_TX_NHWQ] = { "HQ", "NQ", "LQ" };
+	struct urtwm_softc *sc = arg1;
+	struct sbuf *sb;
+	uint64_t samples, stalls;
+	int pg_free[URTWM_TX_NHWQ], used[URTWM_TX_NHWQ];
+	int inflight[URTWM_TX_NHWQ];
+	int error, i, pub;
+
+	URTWM_LOCK(sc);
+	memcpy(pg_free, sc->sc_tx_pg_free, sizeof(pg_free));
+	memcpy(used, sc->sc_tx_pg_used, sizeof(used));
+	memcpy(inflight, sc->sc_tx_pg_inflight, sizeof(inflight));
+	pub = sc->sc_tx_pg_pub;
+	samples = sc->sc_tx_pg_samples;
+	stalls = sc->sc_tx_pg_stalls;
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < URTWM_TX_NHWQ; i++) {
+		sbuf_printf(sb, "\n%s: %d / %d / %d", names[i], pg_free[i],
+		    used[i], inflight[i]);
+	}
+	sbuf_printf(sb, "\npublic: %d, samples: %ju, stalls: %ju", pub,
+	    (uintmax_t)samples, (uintmax_t)stalls);
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+urtwm_sysctl_tx_bql_stats(SYSCTL_HANDLER_ARGS)
+{
+	static const char *names[WME_NUM_AC] = { "BE", "BK", "VI", "VO" };
+	struct urtwm_softc *sc = arg1;
+	struct urtwm_tx_bql bql[WME_NUM_AC];
+	struct sbuf *sb;
+	int error, i;
+
+	URTWM_LOCK(sc);
+	memcpy(bql, sc->sc_tx_bql, sizeof(bql));
+	URTWM_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		sbuf_printf(sb, "\n%s: %d / %d, %jd / %jd, %ju", names[i],
+		    bql[i].limit, bql[i].inflight,
+		    (intmax_t)sbttous(bql[i].sojourn),
+		    (intmax_t)sbttous(bql[i].hw_qtime),
+		    (uintmax_t)bql[i].throttled);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static struct ieee80211_node *
+urtwm_rx_frame(struct urtwm_softc *sc, struct urtwm_rx_node_cache *nc,
+    struct mbuf *m)
+{
+	struct ieee80211com *ic = &sc->sc_ic;
+	struct ieee80211_rx_stats rxs;
+	struct ieee80211_node *ni;
+	struct ieee80211_frame_min *wh;
+	struct urtwm_node *un;
+	struct r92c_rx_stat *stat;
+	uint32_t rxdw0, rxdw3;
+	uint8_t rate, cipher;
+	int8_t rssi;
+	int infosz;
+
+	stat = mtod(m, struct r92c_rx_stat *);
+	rxdw0 = le32toh(stat->rxdw0);
+	rxdw3 = le32toh(stat->rxdw3);
+
+	rate = MS(rxdw3, R92C_RXDW3_RATE);
+	cipher = MS(rxdw0, R92C_RXDW0_CIPHER);
+	infosz = MS(rxdw0, R92C_RXDW0_INFOSZ) * 8;
+
+	wh = (struct ieee80211_frame_min *)(mtod(m, uint8_t *) +
+	    sizeof(*stat) + infosz);
+	memset(&rxs, 0, sizeof(rxs));
+	if ((wh->i_fc[1] & IEEE80211_FC1_PROTECTED) &&
+	    cipher != R92C_CAM_ALGO_NONE) {
+		m->m_flags |= M_WEP;
+
+		/*
+		 * NB: the hardware does not strip IV / MIC, so net80211
+		 * will just remove them without doing any crypto work.
+		 */
+		if (!(rxdw0 & R92C_RXDW0_SWDEC)) {
+			rxs.c_pktflags |= IEEE80211_RX_F_DECRYPTED;
+			sc->sc_rx_hwdec++;
+		}
+	}
+
+	if (m->m_len >= sizeof(*wh))
+		ni = urtwm_rx_node_lookup(sc, nc, m, wh);
+	else
+		ni = NULL;
+	un = URTWM_NODE(ni);
+
+	if (ni != NULL && m->m_len >= sizeof(*stat) + infosz +
+	    sizeof(struct ieee80211_qosframe)) {
+		urtwm_rx_ampdu_check(sc, ni, m,
+		    (const struct ieee80211_frame *)wh, le32toh(stat->rxdw1));
+	}
+
+	/* Get RSSI from PHY status descriptor if present. */
+	if (infosz != 0 && (rxdw0 & R92C_RXDW0_PHYST)) {
+		rssi = urtwm_get_rssi(sc, rate, &stat[1], &rxs);
+		URTWM_DPRINTF(sc, URTWM_DEBUG_RSSI, "%s: rssi=%d\n", __func__,
+		    rssi);
+
+		sc->last_rssi = rssi;
+		if (un != NULL) {
+			un->last_rssi = rssi;
+			urtwm_update_rxstats(sc, un, rate, &stat[1], rssi);
+		}
+	} else
+		rssi = (un != NULL) ? un->last_rssi : sc->last_rssi;
+
+	if (ieee80211_radiotap_active(ic)) {
+		struct urtwm_rx_radiotap_header *tap = &sc->sc_rxtap;
+		uint64_t tsf;
+		int id = URTWM_VAP_ID_INVALID;
+
+		tap->wr_flags = 0;
+		if (le32toh(stat->rxdw4) & R92C_RXDW4_SGI)
+			tap->wr_flags |= IEEE80211_RADIOTAP_F_SHORTGI;
+
+		if (ni != NULL)
+			id = URTWM_VAP(ni->ni_vap)->id;
+		if (id == URTWM_VAP_ID_INVALID)
+			id = 0;
+
+		/*
+		 * Only lower 32 bits are available in the descriptor;
+		 * take the value which is closest to the current TSF.
+		 */
+		tsf = urtwm_get_tsf_cached(sc, id);
+		tsf += (int32_t)(le32toh(stat->rxdw5) - (uint32_t)tsf);
+		tap->wr_tsft = htole64(tsf);
+
+		/* XXX 20/40? */
 
 		/* Map HW rate index to 802.11 rate. */
 		if (rate < URTWM_RIDX_MCS(0))
@@ -1435,14 +2640,225 @@ urtwm_rx_frame(struct urtwm_softc *sc, struct mbuf *m, int8_t *rssi)
 		else	/* MCS0~15. */
 			tap->wr_rate = IEEE80211_RATE_MCS | (rate - 12);
 
-		tap->wr_dbm_antsignal = *rssi;
-		tap->wr_dbm_antnoise = URTWM_NOISE_FLOOR;
+		tap->wr_dbm_antsignal = rssi;
+		tap->wr_dbm_antnoise = URTWM_NOISE_FLOOR;
+	}
+
+	/* Drop descriptor. */
+	m_adj(m, sizeof(*stat) + infosz);
+
+	rxs.r_flags |= IEEE80211_R_NF | IEEE80211_R_RSSI;
+	rxs.c_nf = URTWM_NOISE_FLOOR;
+	rxs.c_rssi = rssi - URTWM_NOISE_FLOOR;
+	if (!ieee80211_add_rx_params(m, &rxs))
+		URTWM_RX_DROP(m) = 1;
+
+	return (ni);
+}
+
+/*
+ * Parses the received buffer and returns it to the inactive
+ * (or, if some mbufs still point into it, loaned) list.
+ */
+static struct mbuf *
+urtwm_rx_process(struct urtwm_softc *sc, struct urtwm_data *data, int len)
+{
+	struct mbuf *m;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	if (sc->sc_rx_zerocopy)
+		refcount_init(&data->ext->refs, 1);
+	m = urtwm_report_intr(sc, data, len);
+	if (sc->sc_rx_zerocopy && !refcount_release(&data->ext->refs)) {
+		/* Will be returned by urtwm_rx_ext_task(). */
+		sc->sc_rx_loans++;
+		STAILQ_INSERT_TAIL(&sc->sc_rx_loaned, data, next);
+	} else
+		STAILQ_INSERT_TAIL(&sc->sc_rx_inactive, data, next);
+
+	return (m);
+}
+
+/*
+ * Passes a frame prepared by urtwm_rx_frame() to net80211.
+ */
+static void
+urtwm_rx_input(struct urtwm_softc *sc, struct mbuf *m)
+{
+	struct ieee80211com *ic = &sc->sc_ic;
+	struct ieee80211_node *ni;
+
+	ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
+	m->m_pkthdr.rcvif = NULL;
+
+	if (URTWM_RX_DROP(m)) {
+		/* Could not attach Rx parameters. */
+		if (ni != NULL && URTWM_RX_NODE_REF(m))
+			ieee80211_free_node(ni);
+		counter_u64_add(ic->ic_ierrors, 1);
+		m_freem(m);
+	} else if (ni != NULL) {
+		/* NB: the frame may be freed by ieee80211_input(). */
+		int owner = URTWM_RX_NODE_REF(m);
+
+		(void)ieee80211_input_mimo(ni, m);
+		if (owner)
+			ieee80211_free_node(ni);
+	} else
+		(void)ieee80211_input_mimo_all(ic, m);
+}
+
+/*
+ * Passes an mbuf chain to net80211; the lock is dropped
+ * (only once) during the process.  When radiotap is active,
+ * frames are processed and delivered one by one instead,
+ * since net80211 reads the (shared) sc_rxtap during input.
+ */
+static void
+urtwm_rx_deliver(struct urtwm_softc *sc, struct mbuf *m)
+{
+	struct ieee80211com *ic = &sc->sc_ic;
+	struct urtwm_rx_node_cache nc;
+	struct mbuf *next;
+	int nframes;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	nframes = 0;
+	sc->sc_rx_lro_td = curthread;
+	if (ieee80211_radiotap_active(ic)) {
+		while (m != NULL) {
+			next = m->m_next;
+			m->m_next = NULL;
+
+			memset(&nc, 0, sizeof(nc));
+			URTWM_RX_DROP(m) = 0;
+			URTWM_RX_NODE_REF(m) = 0;
+			m->m_pkthdr.rcvif = (void *)urtwm_rx_frame(sc, &nc, m);
+			if (nc.ni != NULL)
+				URTWM_RX_NODE_REF(nc.last) = 1;
+			nframes++;
+
+			URTWM_UNLOCK(sc);
+			urtwm_rx_input(sc, m);
+			URTWM_LOCK(sc);
+			m = next;
+		}
+		URTWM_UNLOCK(sc);
+	} else {
+		/*
+		 * Process the whole aggregate while the lock is held;
+		 * the node reference is stashed in the packet header.
+		 */
+		memset(&nc, 0, sizeof(nc));
+		for (next = m; next != NULL; next = next->m_next) {
+			URTWM_RX_DROP(next) = 0;
+			URTWM_RX_NODE_REF(next) = 0;
+			next->m_pkthdr.rcvif =
+			    (void *)urtwm_rx_frame(sc, &nc, next);
+			nframes++;
+		}
+		if (nc.ni != NULL)
+			URTWM_RX_NODE_REF(nc.last) = 1;
+
+		URTWM_UNLOCK(sc);
+		while (m != NULL) {
+			next = m->m_next;
+			m->m_next = NULL;
+			urtwm_rx_input(sc, m);
+			m = next;
+		}
+	}
+	/* NB: flushed segments are passed to urtwm_vap_input() again. */
+	sc->sc_rx_lro_td = NULL;
+	urtwm_rx_lro_flush(sc);
+	URTWM_LOCK(sc);
+
+	sc->sc_rx_batches++;
+	sc->sc_rx_batch_frames += nframes;
+	if (sc->sc_rx_batch_max < nframes)
+		sc->sc_rx_batch_max = nframes;
+}
+
+/*
+ * Receives decapsulated frames from net80211; TCP segments with valid
+ * (hardware-verified) checksum are passed to LRO if it is enabled
+ * and if we are called from urtwm_rx_deliver() (net80211 may also
+ * deliver frames from other contexts, e.g. A-MPDU reorder timeout).
+ */
+static void
+urtwm_vap_input(struct ifnet *ifp, struct mbuf *m)
+{
+	struct ieee80211vap *vap = ifp->if_softc;
+	struct urtwm_vap *uvp = URTWM_VAP(vap);
+#if defined(INET) || defined(INET6)
+	struct urtwm_softc *sc = vap->iv_ic->ic_softc;
+
+	if ((ifp->if_capenable & IFCAP_LRO) &&
+	    sc->sc_rx_lro_td == curthread &&
+	    (m->m_pkthdr.csum_flags & CSUM_DATA_VALID) &&
+	    uvp->id != URTWM_VAP_ID_INVALID &&
+	    tcp_lro_rx(&uvp->lro, m, 0) == 0) {
+		sc->sc_rx_lro_queued++;
+		if (!uvp->lro_pending) {
+			uvp->lro_pending = 1;
+			sc->sc_rx_lro_vaps[uvp->id] = uvp;
+		}
+		return;
+	}
+#endif
+
+	uvp->if_input(ifp, m);
+}
+
+/* Flushes LRO queues at the end of Rx batch. */
+static void
+urtwm_rx_lro_flush(struct urtwm_softc *sc)
+{
+#if defined(INET) || defined(INET6)
+	struct urtwm_vap *uvp;
+	int i;
+
+	for (i = 0; i < nitems(sc->sc_rx_lro_vaps); i++) {
+		uvp = sc->sc_rx_lro_vaps[i];
+		if (uvp == NULL)
+			continue;
+
+		sc->sc_rx_lro_vaps[i] = NULL;
+		uvp->lro_pending = 0;
+		tcp_lro_flush_all(&uvp->lro);
+		sc->sc_rx_lro_flushes++;
 	}
+#endif
+}
 
-	/* Drop descriptor. */
-	m_adj(m, sizeof(*stat) + infosz);
+/*
+ * Rx thread (hint.urtwm.N.rx_deferred=1): processes buffers queued
+ * by urtwm_bulk_rx_callback().
+ */
+static void
+urtwm_rx_task(void *arg, int pending)
+{
+	struct urtwm_softc *sc = arg;
+	struct urtwm_data *data;
+	struct mbuf *m;
 
-	return (ni);
+	URTWM_LOCK(sc);
+	while ((data = STAILQ_FIRST(&sc->sc_rx_pending)) != NULL) {
+		STAILQ_REMOVE_HEAD(&sc->sc_rx_pending, next);
+		sc->sc_rx_pending_cnt--;
+
+		m = urtwm_rx_process(sc, data, data->buflen);
+
+		/* Restart transfers stopped due to lack of buffers. */
+		if (sc->sc_flags & URTWM_RUNNING)
+			urtwm_rx_start(sc);
+
+		if (m != NULL)
+			urtwm_rx_deliver(sc, m);
+	}
+	URTWM_UNLOCK(sc);
 }
 
 static void
@@ -1450,67 +2866,72 @@ urtwm_bulk_rx_callback(struct usb_xfer *xfer, usb_error_t error)
 {
 	struct urtwm_softc *sc = usbd_xfer_softc(xfer);
 	struct ieee80211com *ic = &sc->sc_ic;
-	struct ieee80211_node *ni;
-	struct mbuf *m = NULL, *next;
+	struct mbuf *m = NULL;
 	struct urtwm_data *data;
-	int8_t nf, rssi;
+	int len;
 
 	URTWM_ASSERT_LOCKED(sc);
 
 	switch (USB_GET_STATE(xfer)) {
 	case USB_ST_TRANSFERRED:
-		data = STAILQ_FIRST(&sc->sc_rx_active);
+		data = usbd_xfer_get_priv(xfer);
 		if (data == NULL)
 			goto tr_setup;
-		STAILQ_REMOVE_HEAD(&sc->sc_rx_active, next);
-		m = urtwm_report_intr(sc, xfer, data);
-		STAILQ_INSERT_TAIL(&sc->sc_rx_inactive, data, next);
+		usbd_xfer_set_priv(xfer, NULL);
+		STAILQ_REMOVE(&sc->sc_rx_active, data, urtwm_data,
+		    next);
+
+		sc->sc_rx_xfers++;
+		if (STAILQ_EMPTY(&sc->sc_rx_active)) {
+			/* The pipe was idle while we were processing. */
+			sc->sc_rx_ring_dry++;
+		}
+
+		usbd_xfer_status(xfer, &len, NULL, NULL, NULL);
+		if (!sc->sc_rx_deferred)
+			m = urtwm_rx_process(sc, data, len);
+		else if (sc->sc_rx_pending_cnt >= sc->sc_rx_queue_max) {
+			sc->sc_rx_queue_drops++;
+			counter_u64_add(ic->ic_ierrors, 1);
+			STAILQ_INSERT_TAIL(&sc->sc_rx_inactive, data, next);
+		} else {
+			data->buflen = len;
+			STAILQ_INSERT_TAIL(&sc->sc_rx_pending, data, next);
+			sc->sc_rx_pending_cnt++;
+			taskqueue_enqueue(sc->sc_rx_tq, &sc->sc_rx_task);
+		}
 		/* FALLTHROUGH */
 	case USB_ST_SETUP:
 tr_setup:
 		data = STAILQ_FIRST(&sc->sc_rx_inactive);
 		if (data == NULL) {
-			KASSERT(m == NULL, ("mbuf isn't NULL"));
-			goto finish;
+			sc->sc_rx_nobufs++;
+			if (m == NULL)
+				goto finish;
+		} else {
+			STAILQ_REMOVE_HEAD(&sc->sc_rx_inactive, next);
+			STAILQ_INSERT_TAIL(&sc->sc_rx_active, data, next);
+			usbd_xfer_set_priv(xfer, data);
+			usbd_xfer_set_frame_data(xfer, 0, data->buf,
+			    usbd_xfer_max_len(xfer));
+			usbd_transfer_submit(xfer);
 		}
-		STAILQ_REMOVE_HEAD(&sc->sc_rx_inactive, next);
-		STAILQ_INSERT_TAIL(&sc->sc_rx_active, data, next);
-		usbd_xfer_set_frame_data(xfer, 0, data->buf,
-		    usbd_xfer_max_len(xfer));
-		usbd_transfer_submit(xfer);
 
 		/*
 		 * To avoid LOR we should unlock our private mutex here to call
 		 * ieee80211_input() because here is at the end of a USB
 		 * callback and safe to unlock.
 		 */
-		while (m != NULL) {
-			next = m->m_next;
-			m->m_next = NULL;
-
-			ni = urtwm_rx_frame(sc, m, &rssi);
-
-			URTWM_UNLOCK(sc);
-
-			nf = URTWM_NOISE_FLOOR;
-			if (ni != NULL) {
-				if (ni->ni_flags & IEEE80211_NODE_HT)
-					m->m_flags |= M_AMPDU;
-				(void)ieee80211_input(ni, m, rssi - nf, nf);
-				ieee80211_free_node(ni);
-			} else {
-				(void)ieee80211_input_all(ic, m,
-				    rssi - nf, nf);
-			}
-			URTWM_LOCK(sc);
-			m = next;
-		}
+		if (m != NULL)
+			urtwm_rx_deliver(sc, m);
 		break;
 	default:
 		/* needs it to the inactive queue due to a error. */
-		data = STAILQ_FIRST(&sc->sc_rx_active);
+		data = usbd_xfer_get_priv(xfer);
 		if (data != NULL) {
-			STAILQ_REMOVE_HEAD(&sc->sc_rx_active, next);
+			usbd_xfer_set_priv(xfer, NULL);
+			STAILQ_REMOVE(&sc->sc_rx_active, data, urtwm_data,
+			    next);
 			STAILQ_INSERT_TAIL(&sc->sc_rx_inactive, data, next);
 		}
 		if (error != USB_ERR_CANCELLED) {
@@ -1544,17 +2965,41 @@ urtwm_txeof(struct urtwm_softc *sc, struct urtwm_data *data, int status)
 
 	URTWM_ASSERT_LOCKED(sc);
 
-	if (data->ni != NULL)	/* not a beacon frame */
+	if (data->ni != NULL) {	/* not a beacon frame */
+		struct ieee80211_node *ni;
+		struct mbuf *m, *next;
+
+		next = data->m->m_nextpkt;
+		data->m->m_nextpkt = NULL;
 		ieee80211_tx_complete(data->ni, data->m, status);
 
+		/* Aggregated frames. */
+		while ((m = next) != NULL) {
+			next = m->m_nextpkt;
+			m->m_nextpkt = NULL;
+			ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
+			m->m_pkthdr.rcvif = NULL;
+			ieee80211_tx_complete(ni, m, status);
+		}
+	} else if (data->m != NULL)	/* see urtwm_vap_clear_tx() */
+		m_freem(data->m);
+
 	if (!(sc->sc_flags & URTWM_FW_LOADED))
-		if (sc->sc_tx_n_active > 0)
-			sc->sc_tx_n_active--;
+		sc->sc_tx_n_active = imax(sc->sc_tx_n_active - data->aggnum, 0);
+
+	urtwm_tx_bql_complete(sc, data, 1);
+
+	/* The chip has got the data (see urtwm_tx_pg_sample()). */
+	if (sc->sc_tx_credit) {
+		sc->sc_tx_pg_inflight[
+		    sc->sc_tx_hwq[URTWM_TX_QIDX(data->qid)]] -= data->npages;
+	}
 
 	data->ni = NULL;
 	data->m = NULL;
 
 	STAILQ_INSERT_TAIL(&sc->sc_tx_inactive, data, next);
+	sc->sc_tx_nbufs[URTWM_TX_QIDX(data->qid)]--;
 }
 
 static int
@@ -1587,16 +3032,27 @@ urtwm_alloc_rx_list(struct urtwm_softc *sc)
 {
         int error, i;
 
-	error = urtwm_alloc_list(sc, sc->sc_rx, URTWM_RX_LIST_COUNT,
-	    URTWM_RXBUFSZ);
+	/* NB: the trailer is used in zero-copy mode only. */
+	error = urtwm_alloc_list(sc, sc->sc_rx, sc->sc_rx_list_count,
+	    sc->sc_rx_bufsz + sizeof(struct urtwm_rx_ext));
 	if (error != 0)
 		return (error);
 
 	STAILQ_INIT(&sc->sc_rx_active);
 	STAILQ_INIT(&sc->sc_rx_inactive);
+	STAILQ_INIT(&sc->sc_rx_loaned);
+	STAILQ_INIT(&sc->sc_rx_pending);
+	sc->sc_rx_pending_cnt = 0;
 
-	for (i = 0; i < URTWM_RX_LIST_COUNT; i++)
-		STAILQ_INSERT_HEAD(&sc->sc_rx_inactive, &sc->sc_rx[i], next);
+	for (i = 0; i < sc->sc_rx_list_count; i++) {
+		struct urtwm_data *dp = &sc->sc_rx[i];
+
+		dp->ext = (struct urtwm_rx_ext *)(dp->buf + sc->sc_rx_bufsz);
+		dp->ext->refs = 0;
+		dp->ext->returned = 0;
+		dp->ext->sc = sc;
+		STAILQ_INSERT_HEAD(&sc->sc_rx_inactive, dp, next);
+	}
 
 	return (0);
 }
@@ -1607,13 +3063,17 @@ urtwm_alloc_tx_list(struct urtwm_softc *sc)
 	int error, i;
 
 	error = urtwm_alloc_list(sc, sc->sc_tx, URTWM_TX_LIST_COUNT,
-	    URTWM_TXBUFSZ);
+	    sc->sc_tx_bufsz);
 	if (error != 0)
 		return (error);
 
 	STAILQ_INIT(&sc->sc_tx_active);
 	STAILQ_INIT(&sc->sc_tx_inactive);
-	STAILQ_INIT(&sc->sc_tx_pending);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		STAILQ_INIT(&sc->sc_tx_pending[i]);
+		sc->sc_tx_nbufs[i] = 0;
+	}
+	urtwm_tx_bql_reset(sc);
 
 	for (i = 0; i < URTWM_TX_LIST_COUNT; i++)
 		STAILQ_INSERT_HEAD(&sc->sc_tx_inactive, &sc->sc_tx[i], next);
@@ -1633,41 +3093,93 @@ urtwm_free_list(struct urtwm_softc *sc, struct urtwm_data data[], int ndata)
 			free(dp->buf, M_USBDEV);
 			dp->buf = NULL;
 		}
-		if (dp->ni != NULL) {
-			ieee80211_free_node(dp->ni);
-			dp->ni = NULL;
-		}
-		if (dp->m != NULL) {
-			m_freem(dp->m);
-			dp->m = NULL;
-		}
+		urtwm_tx_free_frames(dp);
 	}
 }
 
 static void
 urtwm_free_rx_list(struct urtwm_softc *sc)
 {
-	urtwm_free_list(sc, sc->sc_rx, URTWM_RX_LIST_COUNT);
+	struct urtwm_data *data;
+	int i;
+
+	/*
+	 * Buffers which are still referenced by mbufs will be freed
+	 * by urtwm_rx_ext_free() later.
+	 */
+	mtx_lock(&urtwm_rx_ext_mtx);
+	STAILQ_FOREACH(data, &sc->sc_rx_loaned, next) {
+		if (data->ext->returned)
+			continue;
+
+		data->ext->sc = NULL;
+		data->buf = NULL;
+		urtwm_rx_orphans++;
+	}
+	mtx_unlock(&urtwm_rx_ext_mtx);
+
+	urtwm_free_list(sc, sc->sc_rx, sc->sc_rx_list_count);
+	for (i = 0; i < sc->sc_rx_list_count; i++)
+		sc->sc_rx[i].ext = NULL;
+
+	/* Forget about buffers attached to (stopped) transfers. */
+	for (i = 0; i < sc->sc_rx_list_count; i++) {
+		struct usb_xfer *xfer = sc->sc_xfer[URTWM_BULK_RX_XFER(i)];
+
+		if (xfer != NULL)
+			usbd_xfer_set_priv(xfer, NULL);
+	}
 
 	STAILQ_INIT(&sc->sc_rx_active);
 	STAILQ_INIT(&sc->sc_rx_inactive);
+	STAILQ_INIT(&sc->sc_rx_loaned);
+	STAILQ_INIT(&sc->sc_rx_pending);
+	sc->sc_rx_pending_cnt = 0;
 }
 
 static void
 urtwm_free_tx_list(struct urtwm_softc *sc)
 {
+	int i, j;
+
 	urtwm_free_list(sc, sc->sc_tx, URTWM_TX_LIST_COUNT);
 
+	/* Forget about buffers attached to (stopped) transfers. */
+	for (i = URTWM_BULK_TX_BE; i <= URTWM_BULK_TX_VO; i++) {
+		for (j = 0; j < sc->sc_tx_depth; j++) {
+			struct usb_xfer *xfer =
+			    sc->sc_xfer[URTWM_BULK_TX_XFER(sc, i, j)];
+
+			if (xfer != NULL)
+				usbd_xfer_set_priv(xfer, NULL);
+		}
+	}
+
 	STAILQ_INIT(&sc->sc_tx_active);
 	STAILQ_INIT(&sc->sc_tx_inactive);
-	STAILQ_INIT(&sc->sc_tx_pending);
+	for (i = 0; i < WME_NUM_AC; i++) {
+		STAILQ_INIT(&sc->sc_tx_pending[i]);
+		sc->sc_tx_nbufs[i] = 0;
+	}
+	urtwm_tx_bql_reset(sc);
+}
+
+static void
+urtwm_rx_start(struct urtwm_softc *sc)
+{
+	int i;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	for (i = 0; i < sc->sc_rx_list_count; i++)
+		usbd_transfer_start(sc->sc_xfer[URTWM_BULK_RX_XFER(i)]);
 }
 
 static void
 urtwm_r12a_transfer_submit(struct urtwm_softc *sc, struct usb_xfer *xfer,
     struct urtwm_data *data)
 {
-	usbd_xfer_set_frame_data(xfer, 0, data->buf, data->buflen);
+	usbd_xfer_set_frame_data(xfer, 0, data->txbuf, data->buflen);
 	usbd_transfer_submit(xfer);
 }
 
@@ -1703,75 +3215,403 @@ urtwm_r21a_transfer_submit(struct urtwm_softc *sc, struct usb_xfer *xfer,
 }
 
 static void
-urtwm_bulk_tx_callback(struct usb_xfer *xfer, usb_error_t error)
+urtwm_bulk_tx_callback(struct usb_xfer *xfer, usb_error_t error, int qid)
 {
 	struct urtwm_softc *sc = usbd_xfer_softc(xfer);
+	struct urtwm_tx_ac_stats *stats = &sc->sc_tx_ac[URTWM_TX_QIDX(qid)];
+	urtwm_datahead *pending = &sc->sc_tx_pending[URTWM_TX_QIDX(qid)];
 	struct urtwm_data *data;
+	sbintime_t lat;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	switch (USB_GET_STATE(xfer)){
+	case USB_ST_TRANSFERRED:
+		data = usbd_xfer_get_priv(xfer);
+		if (data == NULL)
+			goto tr_setup;
+		usbd_xfer_set_priv(xfer, NULL);
+		STAILQ_REMOVE(&sc->sc_tx_active, data, urtwm_data, next);
+
+		lat = sbinuptime() - data->sbt;
+		stats->lat_sum += lat;
+		if (stats->lat_max < lat)
+			stats->lat_max = lat;
+
+		urtwm_txeof(sc, data, 0);
+		/* FALLTHROUGH */
+	case USB_ST_SETUP:
+tr_setup:
+		data = STAILQ_FIRST(pending);
+		if (data == NULL) {
+			URTWM_DPRINTF(sc, URTWM_DEBUG_XMIT,
+			    "%s: empty pending queue\n", __func__);
+			if (STAILQ_EMPTY(&sc->sc_tx_active))
+				sc->sc_tx_n_active = 0;
+			goto finish;
+		}
+		if (!urtwm_tx_pg_charge(sc, qid, data)) {
+			/* Will be restarted by urtwm_tx_pg_sample(). */
+			goto finish;
+		}
+		STAILQ_REMOVE_HEAD(pending, next);
+		STAILQ_INSERT_TAIL(&sc->sc_tx_active, data, next);
+		usbd_xfer_set_priv(xfer, data);
+		data->sbt = sbinuptime();
+		urtwm_transfer_submit(sc, xfer, data);
+		sc->sc_tx_xfers++;
+		sc->sc_tx_frames += data->aggnum;
+		stats->xfers++;
+		stats->frames += data->aggnum;
+		stats->bytes += data->buflen;
+		if (!(sc->sc_flags & URTWM_FW_LOADED))
+			sc->sc_tx_n_active += data->aggnum;
+		break;
+	default:
+		data = usbd_xfer_get_priv(xfer);
+		if (data == NULL)
+			goto tr_setup;
+		usbd_xfer_set_priv(xfer, NULL);
+		STAILQ_REMOVE(&sc->sc_tx_active, data, urtwm_data, next);
+		urtwm_txeof(sc, data, 1);
+		if (error != USB_ERR_CANCELLED) {
+			usbd_xfer_set_stall(xfer);
+			goto tr_setup;
+		}
+		break;
+	}
+finish:
+#ifdef	IEEE80211_SUPPORT_SUPERG
+	/*
+	 * If the TX active queue drops below a certain
+	 * threshold, ensure we age fast-frames out so they're
+	 * transmitted.
+	 */
+	if (!(sc->sc_flags & URTWM_FW_LOADED) && sc->sc_tx_n_active <= 1) {
+		/* XXX ew - net80211 should defer this for us! */
+
+		/*
+		 * Note: this sc_tx_n_active currently tracks
+		 * the number of pending transmit submissions
+		 * and not the actual depth of the TX frames
+		 * pending to the hardware.  That means that
+		 * we're going to end up with some sub-optimal
+		 * aggregation behaviour.
+		 */
+		/*
+		 * XXX TODO: just make this a callout timer schedule so we can
+		 * flush the FF staging queue if we're approaching idle.
+		 */
+		urtwm_cmd_sleepable(sc, NULL, 0, urtwm_ff_flush_all);
+	}
+#endif
+	/* Kick-start more transmit */
+	urtwm_start(sc);
+}
+
+static void
+urtwm_bulk_tx_be_callback(struct usb_xfer *xfer, usb_error_t error)
+{
+	urtwm_bulk_tx_callback(xfer, error, URTWM_BULK_TX_BE);
+}
+
+static void
+urtwm_bulk_tx_bk_callback(struct usb_xfer *xfer, usb_error_t error)
+{
+	urtwm_bulk_tx_callback(xfer, error, URTWM_BULK_TX_BK);
+}
+
+static void
+urtwm_bulk_tx_vi_callback(struct usb_xfer *xfer, usb_error_t error)
+{
+	urtwm_bulk_tx_callback(xfer, error, URTWM_BULK_TX_VI);
+}
+
+static void
+urtwm_bulk_tx_vo_callback(struct usb_xfer *xfer, usb_error_t error)
+{
+	urtwm_bulk_tx_callback(xfer, error, URTWM_BULK_TX_VO);
+}
+
+/* Starts an idle transfer (if any) for the given Tx queue. */
+static void
+urtwm_tx_kick(struct urtwm_softc *sc, int qid)
+{
+	struct usb_xfer *xfer;
+	int i;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	for (i = 0; i < sc->sc_tx_depth; i++) {
+		xfer = sc->sc_xfer[URTWM_BULK_TX_XFER(sc, qid, i)];
+		if (!usbd_transfer_pending(xfer)) {
+			usbd_transfer_start(xfer);
+			break;
+		}
+	}
+}
+
+static void
+urtwm_tx_bql_reset(struct urtwm_softc *sc)
+{
+	struct urtwm_tx_bql *bql;
+	int i;
+
+	for (i = 0; i < WME_NUM_AC; i++) {
+		bql = &sc->sc_tx_bql[i];
+		bql->limit_min = sc->sc_tx_bufsz;
+		bql->limit_max = sc->sc_tx_bufsz * URTWM_TX_LIST_COUNT;
+		bql->limit = bql->limit_min;
+		bql->inflight = 0;
+		bql->slack = INT_MAX;
+		bql->last_adj = 0;
+		bql->sojourn = 0;
+		bql->hw_qtime = 0;
+		bql->hw_qtime_last = 0;
+	}
+}
+
+/*
+ * Dynamic byte queue limit (BQL-like): the limit grows when the queue
+ * was drained while frames were held in sc_snd, shrinks when the
+ * queueing delay (time in Tx buffers + the chip queue time from Tx
+ * reports) exceeds the target, and drops the unused part (slack) once
+ * per URTWM_TX_BQL_INTERVAL.  The chip queue time is ignored when there
+ * were no Tx reports during the last interval.
+ */
+static void
+urtwm_tx_bql_complete(struct urtwm_softc *sc, struct urtwm_data *data,
+    int done)
+{
+	struct urtwm_tx_bql *bql;
+	sbintime_t now;
+	int bytes, qidx;
+
+	if (data->bql_bytes == 0)
+		return;
+
+	qidx = URTWM_TX_QIDX(data->qid);
+	bql = &sc->sc_tx_bql[qidx];
+	bytes = data->bql_bytes;
+	data->bql_bytes = 0;
+	bql->inflight -= bytes;
+	if (!done)
+		return;
+
+	now = sbinuptime();
+	bql->sojourn += (now - data->qsbt - bql->sojourn) / 8;
+	if (bql->slack > bql->inflight)
+		bql->slack = bql->inflight;
+	if (now - bql->hw_qtime_last >= URTWM_TX_BQL_INTERVAL)
+		bql->hw_qtime = 0;
+
+	if (bql->inflight == 0 && urtwm_tx_ac_len(sc, qidx) != 0) {
+		/* Starved. */
+		bql->limit = imin(bql->limit + bytes, bql->limit_max);
+		bql->slack = INT_MAX;
+	} else if (bql->sojourn + bql->hw_qtime > sc->sc_tx_bql_target) {
+		/* Too much queueing delay. */
+		bql->limit = imax(bql->limit - bql->limit / 8,
+		    bql->limit_min);
+	}
+
+	if (now - bql->last_adj >= URTWM_TX_BQL_INTERVAL) {
+		if (bql->slack != INT_MAX) {
+			bql->limit = imax(bql->limit - bql->slack,
+			    bql->limit_min);
+		}
+		bql->slack = INT_MAX;
+		bql->last_adj = now;
+	}
+}
+
+static void
+urtwm_tx_bql_report(struct urtwm_softc *sc,
+    const struct r12a_c2h_tx_rpt *rpt)
+{
+	struct urtwm_tx_bql *bql;
+	sbintime_t now, qtime;
+	uint8_t qsel;
+
+	qsel = MS(rpt->txrptb0, R12A_TXRPTB0_QSEL);
+	if (qsel < URTWM_MAX_TID)
+		bql = &sc->sc_tx_bql[TID_TO_WME_AC(qsel)];
+	else
+		bql = &sc->sc_tx_bql[WME_AC_VO];
+
+	qtime = le16toh(rpt->queue_time) * 256 * SBT_1US;
+	now = sbinuptime();
+	if (now - bql->hw_qtime_last >= URTWM_TX_BQL_INTERVAL)
+		bql->hw_qtime = qtime;	/* stale */
+	else
+		bql->hw_qtime += (qtime - bql->hw_qtime) / 8;
+	bql->hw_qtime_last = now;
+}
+
+/*
+ * Tx packet buffer accounting.  Every frame takes
+ * howmany(descriptor + frame length, page_size) pages from the dedicated
+ * pages of its hardware queue, or from the public pool when those are
+ * exhausted.  The chip drops frames it has no pages for
+ * (R92C_TXDMA_OFFSET_DROP_DATA_EN), so transfers are held back when the
+ * estimate runs out.  The estimate is the last R92C_FIFOPAGE sample
+ * minus pages submitted after it (including transfers that were still
+ * in flight when the sample was taken).
+ */
+static void
+urtwm_tx_pg_init(struct urtwm_softc *sc, int hpq, int npq, int lpq)
+{
+	int i;
+
+	sc->sc_tx_pg_free[URTWM_TX_HWQ_HIGH] = hpq;
+	sc->sc_tx_pg_free[URTWM_TX_HWQ_NORMAL] = npq;
+	sc->sc_tx_pg_free[URTWM_TX_HWQ_LOW] = lpq;
+	sc->sc_tx_pg_pub = sc->npubqpages;
+	for (i = 0; i < URTWM_TX_NHWQ; i++) {
+		sc->sc_tx_pg_used[i] = 0;
+		sc->sc_tx_pg_used_next[i] = 0;
+		sc->sc_tx_pg_inflight[i] = 0;
+	}
+	sc->sc_tx_pg_sampling = 0;
+	sc->sc_tx_pg_blocked = 0;
+
+	/* NB: keep in sync with urtwm_setup_endpoints(). */
+	sc->sc_tx_hwq[WME_AC_VO] = URTWM_TX_HWQ_HIGH;
+	switch (sc->ntx) {
+	case 4:
+	case 3:
+		sc->sc_tx_hwq[WME_AC_BE] = URTWM_TX_HWQ_LOW;
+		sc->sc_tx_hwq[WME_AC_BK] = URTWM_TX_HWQ_LOW;
+		sc->sc_tx_hwq[WME_AC_VI] = URTWM_TX_HWQ_NORMAL;
+		break;
+	case 2:
+		sc->sc_tx_hwq[WME_AC_BE] = URTWM_TX_HWQ_NORMAL;
+		sc->sc_tx_hwq[WME_AC_BK] = URTWM_TX_HWQ_NORMAL;
+		sc->sc_tx_hwq[WME_AC_VI] = URTWM_TX_HWQ_HIGH;
+		break;
+	default:
+		sc->sc_tx_hwq[WME_AC_BE] = URTWM_TX_HWQ_HIGH;
+		sc->sc_tx_hwq[WME_AC_BK] = URTWM_TX_HWQ_HIGH;
+		sc->sc_tx_hwq[WME_AC_VI] = URTWM_TX_HWQ_HIGH;
+		break;
+	}
+}
+
+static int
+urtwm_tx_pg_avail(struct urtwm_softc *sc, int hwq)
+{
+	int avail, i;
+
+	avail = sc->sc_tx_pg_free[hwq] + sc->sc_tx_pg_pub -
+	    sc->sc_tx_pg_used[hwq];
+
+	/* Public pages taken by other queues. */
+	for (i = 0; i < URTWM_TX_NHWQ; i++) {
+		if (i != hwq) {
+			avail -= imax(sc->sc_tx_pg_used[i] -
+			    sc->sc_tx_pg_free[i], 0);
+		}
+	}
+
+	return (avail);
+}
+
+/*
+ * Returns 0 if the transfer must wait for free pages.
+ */
+static int
+urtwm_tx_pg_charge(struct urtwm_softc *sc, int qid, struct urtwm_data *data)
+{
+	int hwq, qidx;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	/* NB: beacons and reserved pages are not accounted here. */
+	if (!sc->sc_tx_credit || data->npages == 0)
+		return (1);
+
+	qidx = URTWM_TX_QIDX(qid);
+	hwq = sc->sc_tx_hwq[qidx];
+	if (urtwm_tx_pg_avail(sc, hwq) < data->npages) {
+		if (!(sc->sc_tx_pg_blocked & (1 << qidx))) {
+			sc->sc_tx_pg_blocked |= 1 << qidx;
+			sc->sc_tx_pg_stalls++;
+		}
+
+		/* Poll until some pages will be freed. */
+		if (!callout_pending(&sc->sc_tx_pg_to))
+			callout_reset(&sc->sc_tx_pg_to, 1, urtwm_tx_pg_to, sc);
+		return (0);
+	}
+
+	sc->sc_tx_pg_used[hwq] += data->npages;
+	sc->sc_tx_pg_used_next[hwq] += data->npages;
+	sc->sc_tx_pg_inflight[hwq] += data->npages;
+
+	/* Refresh the estimate before it runs out. */
+	if (urtwm_tx_pg_avail(sc, hwq) <
+	    (sc->sc_tx_pg_free[hwq] + sc->sc_tx_pg_pub) / 2)
+		urtwm_tx_pg_sample_req(sc);
+
+	return (1);
+}
+
+static void
+urtwm_tx_pg_sample_req(struct urtwm_softc *sc)
+{
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	if (sc->sc_tx_pg_sampling)
+		return;
+
+	if (urtwm_cmd_sleepable(sc, NULL, 0, urtwm_tx_pg_sample) == 0)
+		sc->sc_tx_pg_sampling = 1;
+}
+
+static void
+urtwm_tx_pg_sample(struct urtwm_softc *sc, union sec_param *data)
+{
+	uint32_t reg;
+	uint16_t npq;
+	int blocked, i;
 
 	URTWM_ASSERT_LOCKED(sc);
 
-	switch (USB_GET_STATE(xfer)){
-	case USB_ST_TRANSFERRED:
-		data = STAILQ_FIRST(&sc->sc_tx_active);
-		if (data == NULL)
-			goto tr_setup;
-		STAILQ_REMOVE_HEAD(&sc->sc_tx_active, next);
-		urtwm_txeof(sc, data, 0);
-		/* FALLTHROUGH */
-	case USB_ST_SETUP:
-tr_setup:
-		data = STAILQ_FIRST(&sc->sc_tx_pending);
-		if (data == NULL) {
-			URTWM_DPRINTF(sc, URTWM_DEBUG_XMIT,
-			    "%s: empty pending queue\n", __func__);
-			sc->sc_tx_n_active = 0;
-			goto finish;
-		}
-		STAILQ_REMOVE_HEAD(&sc->sc_tx_pending, next);
-		STAILQ_INSERT_TAIL(&sc->sc_tx_active, data, next);
-		urtwm_transfer_submit(sc, xfer, data);
-		if (!(sc->sc_flags & URTWM_FW_LOADED))
-			sc->sc_tx_n_active++;
-		break;
-	default:
-		data = STAILQ_FIRST(&sc->sc_tx_active);
-		if (data == NULL)
-			goto tr_setup;
-		STAILQ_REMOVE_HEAD(&sc->sc_tx_active, next);
-		urtwm_txeof(sc, data, 1);
-		if (error != USB_ERR_CANCELLED) {
-			usbd_xfer_set_stall(xfer);
-			goto tr_setup;
-		}
-		break;
-	}
-finish:
-#ifdef	IEEE80211_SUPPORT_SUPERG
 	/*
-	 * If the TX active queue drops below a certain
-	 * threshold, ensure we age fast-frames out so they're
-	 * transmitted.
+	 * Transfers in flight are not visible in the sample;
+	 * NB: the lock is dropped while registers are read.
 	 */
-	if (!(sc->sc_flags & URTWM_FW_LOADED) && sc->sc_tx_n_active <= 1) {
-		/* XXX ew - net80211 should defer this for us! */
+	memcpy(sc->sc_tx_pg_used_next, sc->sc_tx_pg_inflight,
+	    sizeof(sc->sc_tx_pg_used_next));
 
-		/*
-		 * Note: this sc_tx_n_active currently tracks
-		 * the number of pending transmit submissions
-		 * and not the actual depth of the TX frames
-		 * pending to the hardware.  That means that
-		 * we're going to end up with some sub-optimal
-		 * aggregation behaviour.
-		 */
-		/*
-		 * XXX TODO: just make this a callout timer schedule so we can
-		 * flush the FF staging queue if we're approaching idle.
-		 */
-		urtwm_cmd_sleepable(sc, NULL, 0, urtwm_ff_flush_all);
+	reg = urtwm_read_4(sc, R92C_FIFOPAGE);
+	npq = urtwm_read_2(sc, R92C_RQPN_NPQ);
+	sc->sc_tx_pg_sampling = 0;
+
+	sc->sc_tx_pg_free[URTWM_TX_HWQ_HIGH] = MS(reg, R92C_FIFOPAGE_HPQ);
+	sc->sc_tx_pg_free[URTWM_TX_HWQ_NORMAL] = MS(npq, R92C_RQPN_NPQ_AVAIL);
+	sc->sc_tx_pg_free[URTWM_TX_HWQ_LOW] = MS(reg, R92C_FIFOPAGE_LPQ);
+	sc->sc_tx_pg_pub = MS(reg, R92C_FIFOPAGE_PUBQ);
+	memcpy(sc->sc_tx_pg_used, sc->sc_tx_pg_used_next,
+	    sizeof(sc->sc_tx_pg_used));
+	sc->sc_tx_pg_samples++;
+
+	/* Restart held transfers. */
+	blocked = sc->sc_tx_pg_blocked;
+	sc->sc_tx_pg_blocked = 0;
+	for (i = 0; i < WME_NUM_AC; i++) {
+		if (blocked & (1 << i))
+			urtwm_tx_kick(sc, URTWM_BULK_TX_BE + i);
 	}
-#endif
-	/* Kick-start more transmit */
-	urtwm_start(sc);
+}
+
+static void
+urtwm_tx_pg_to(void *arg)
+{
+	struct urtwm_softc *sc = arg;
+
+	urtwm_tx_pg_sample_req(sc);
 }
 
 static struct urtwm_data *
@@ -1780,9 +3620,14 @@ _urtwm_getbuf(struct urtwm_softc *sc)
 	struct urtwm_data *bf;
 
 	bf = STAILQ_FIRST(&sc->sc_tx_inactive);
-	if (bf != NULL)
+	if (bf != NULL) {
 		STAILQ_REMOVE_HEAD(&sc->sc_tx_inactive, next);
-	else {
+		bf->txbuf = bf->buf;
+		bf->buflen = 0;
+		bf->aggnum = 0;
+		bf->npages = 0;
+		bf->bql_bytes = 0;
+	} else {
 		URTWM_DPRINTF(sc, URTWM_DEBUG_XMIT,
 		    "%s: out of xmit buffers\n", __func__);
 	}
@@ -1804,6 +3649,71 @@ urtwm_getbuf(struct urtwm_softc *sc)
 	return (bf);
 }
 
+/*
+ * Returns the last pending buffer if the frame can be appended to it
+ * (the same Tx queue and vap); otherwise allocates a new one, unless
+ * all free buffers are reserved for other queues (sc_tx_resv[]).
+ */
+static struct urtwm_data *
+urtwm_tx_getbuf(struct urtwm_softc *sc, struct mbuf *m)
+{
+	struct ieee80211_node *ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
+	struct urtwm_data *data;
+	int i, nfree, qidx, reserved;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	qidx = URTWM_TX_QIDX(urtwm_tx_qid(m));
+	data = STAILQ_LAST(&sc->sc_tx_pending[qidx], urtwm_data, next);
+	if (data != NULL && data->ni != NULL && data->txbuf == data->buf &&
+	    data->aggnum < sc->sc_tx_agg_max &&
+	    data->ni->ni_vap == ni->ni_vap &&
+	    roundup2(data->buflen, 8) + URTWM_TXBUFSZ <= sc->sc_tx_bufsz)
+		return (data);
+
+	/* Do not take buffers reserved for other queues. */
+	nfree = URTWM_TX_LIST_COUNT;
+	reserved = 0;
+	for (i = 0; i < WME_NUM_AC; i++) {
+		nfree -= sc->sc_tx_nbufs[i];
+		if (i != qidx)
+			reserved += imax(sc->sc_tx_resv[i] -
+			    sc->sc_tx_nbufs[i], 0);
+	}
+	if (nfree <= reserved) {
+		URTWM_DPRINTF(sc, URTWM_DEBUG_XMIT,
+		    "%s: no unreserved buffers for queue %d\n",
+		    __func__, qidx);
+		return (NULL);
+	}
+
+	return (urtwm_getbuf(sc));
+}
+
+static void
+urtwm_tx_free_frames(struct urtwm_data *dp)
+{
+	struct mbuf *m, *next;
+
+	if (dp->m != NULL) {
+		next = dp->m->m_nextpkt;
+		dp->m->m_nextpkt = NULL;
+		while ((m = next) != NULL) {
+			next = m->m_nextpkt;
+			m->m_nextpkt = NULL;
+			ieee80211_free_node(
+			    (struct ieee80211_node *)m->m_pkthdr.rcvif);
+			m_freem(m);
+		}
+		m_freem(dp->m);
+		dp->m = NULL;
+	}
+	if (dp->ni != NULL) {
+		ieee80211_free_node(dp->ni);
+		dp->ni = NULL;
+	}
+}
+
 static usb_error_t
 urtwm_write_region_1(struct urtwm_softc *sc, uint16_t addr, uint8_t *buf,
     int len)
@@ -2274,7 +4184,7 @@ urtwm_setup_endpoints(struct urtwm_softc *sc)
 {
 	struct usb_endpoint *ep, *ep_end;
 	uint8_t addr[R12A_MAX_EPOUT];
-	int error;
+	int error, i;
 
 	/* Determine the number of bulk-out pipes. */
 	sc->ntx = 0;
@@ -2332,8 +4242,42 @@ urtwm_setup_endpoints(struct urtwm_softc *sc)
 		break;
 	}
 
+	urtwm_config[URTWM_BULK_RX].bufsize = sc->sc_rx_bufsz;
+
+	/* Clone Rx transfer configuration for the rest of the Rx ring. */
+	for (i = 1; i < sc->sc_rx_list_count; i++) {
+		urtwm_config[URTWM_BULK_RX_XFER(i)] =
+		    urtwm_config[URTWM_BULK_RX];
+	}
+
+	/* NB: Tx transfers are always set up. */
+	error = usbd_transfer_setup(sc->sc_udev, &sc->sc_iface_index,
+	    sc->sc_xfer, urtwm_config,
+	    MAX(URTWM_BULK_TX_VO + 1,
+	    URTWM_BULK_RX_XFER(sc->sc_rx_list_count - 1) + 1), sc, &sc->sc_mtx);
+	if (error) {
+		device_printf(sc->sc_dev, "could not allocate USB transfers, "
+		    "err=%s\n", usbd_errstr(error));
+		return (error);
+	}
+
+	if (sc->sc_tx_depth == 1)
+		return (0);
+
+	/* Clone Tx transfer configurations (they are placed separately). */
+	for (i = URTWM_BULK_TX_BE; i <= URTWM_BULK_TX_VO; i++) {
+		int j;
+
+		for (j = 1; j < sc->sc_tx_depth; j++) {
+			urtwm_config[URTWM_BULK_TX_XFER(sc, i, j)] =
+			    urtwm_config[i];
+		}
+	}
+
 	error = usbd_transfer_setup(sc->sc_udev, &sc->sc_iface_index,
-	    sc->sc_xfer, urtwm_config, URTWM_N_TRANSFER, sc, &sc->sc_mtx);
+	    &sc->sc_xfer[URTWM_BULK_TX_EXTRA],
+	    &urtwm_config[URTWM_BULK_TX_EXTRA],
+	    WME_NUM_AC * (sc->sc_tx_depth - 1), sc, &sc->sc_mtx);
 	if (error) {
 		device_printf(sc->sc_dev, "could not allocate USB transfers, "
 		    "err=%s\n", usbd_errstr(error));
@@ -2527,14 +4471,120 @@ urtwm_config_specific(struct urtwm_softc *sc)
 		sc->sc_transfer_submit = urtwm_r21a_transfer_submit;
 	else
 		sc->sc_transfer_submit = urtwm_r12a_transfer_submit;
+}
 
-	if (usbd_get_speed(sc->sc_udev) == USB_SPEED_SUPER) {
-		sc->ac_usb_dma_size = 0x07;
-		sc->ac_usb_dma_time = 0x1a;
-	} else {
-		sc->ac_usb_dma_size = 0x01;
-		sc->ac_usb_dma_time = 0x10;
+static void
+urtwm_config_rx(struct urtwm_softc *sc)
+{
+	int bufsz, bufsz_min, i;
+
+	if (usbd_get_speed(sc->sc_udev) == USB_SPEED_SUPER)
+		sc->sc_rxagg_def = URTWM_RXAGG_DEF_USB3;
+	else
+		sc->sc_rxagg_def = URTWM_RXAGG_DEF_USB2;
+
+	/*
+	 * Aggregation stops after the threshold is reached,
+	 * so the last frame may cross it.  Size the buffer for
+	 * the largest profile the controller may switch to.
+	 */
+	bufsz = URTWM_RXBUFSZ;
+	for (i = 0; i < nitems(urtwm_rxagg_profiles); i++) {
+		int sz;
+
+		sz = urtwm_rxagg_profiles[i].size * R12A_RXDMA_AGG_PG_UNIT +
+		    URTWM_RX_MAXFRAMELEN;
+		sz = roundup2(sz, 1024);
+		if (sz > URTWM_RXBUFSZ_MAX)
+			break;
+		bufsz = MAX(bufsz, sz);
+	}
+
+	/* NB: the smallest profile is always used as a fallback. */
+	bufsz_min = urtwm_rxagg_profiles[0].size * R12A_RXDMA_AGG_PG_UNIT +
+	    URTWM_RX_MAXFRAMELEN;
+	bufsz_min = MAX(roundup2(bufsz_min, 1024), URTWM_RXBUFSZ_MIN);
+
+	sc->sc_rx_bufsz = urtwm_get_tunable(sc, "rx_bufsz", bufsz,
+	    bufsz_min, URTWM_RXBUFSZ_MAX);
+
+	/* Do not use profiles which will not fit into Rx buffer. */
+	sc->sc_rxagg_max = 0;
+	for (i = 1; i < nitems(urtwm_rxagg_profiles); i++) {
+		if (urtwm_rxagg_profiles[i].size * R12A_RXDMA_AGG_PG_UNIT +
+		    URTWM_RX_MAXFRAMELEN > sc->sc_rx_bufsz)
+			break;
+		sc->sc_rxagg_max = i;
+	}
+	sc->sc_rxagg_def = MIN(sc->sc_rxagg_def, sc->sc_rxagg_max);
+	sc->sc_rxagg_pin = -1;
+
+	sc->ac_usb_dma_size = urtwm_rxagg_profiles[sc->sc_rxagg_def].size;
+	sc->ac_usb_dma_time = urtwm_rxagg_profiles[sc->sc_rxagg_def].time;
+}
+
+static void
+urtwm_config_tx(struct urtwm_softc *sc)
+{
+	static const char *ac_names[WME_NUM_AC] = { "be", "bk", "vi", "vo" };
+	static const int def_resv[WME_NUM_AC] = { 1, 1, 2, 2 };
+	static const int def_weight[WME_NUM_AC] = { 2, 1, 3, 4 };
+	const char *name;
+	char hint[16];
+	int depth, i;
+
+	/* Number of bulk-out transfers in flight per Tx queue. */
+	switch (usbd_get_speed(sc->sc_udev)) {
+	case USB_SPEED_SUPER:
+		name = "tx_depth_ss";
+		depth = URTWM_TX_DEPTH_SS;
+		break;
+	case USB_SPEED_HIGH:
+		name = "tx_depth_hs";
+		depth = URTWM_TX_DEPTH_HS;
+		break;
+	default:
+		name = "tx_depth_fs";
+		depth = URTWM_TX_DEPTH_FS;
+		break;
 	}
+
+	sc->sc_tx_depth = urtwm_get_tunable(sc, name, depth, 1,
+	    URTWM_TX_DEPTH_MAX);
+
+	/* Per-queue buffer reservations and scheduler. */
+	for (i = 0; i < WME_NUM_AC; i++) {
+		snprintf(hint, sizeof(hint), "tx_resv_%s", ac_names[i]);
+		sc->sc_tx_resv[i] = urtwm_get_tunable(sc, hint,
+		    def_resv[i], 0, URTWM_TX_RESV_MAX);
+		snprintf(hint, sizeof(hint), "tx_weight_%s", ac_names[i]);
+		sc->sc_tx_quantum[i] = IEEE80211_MAX_LEN *
+		    urtwm_get_tunable(sc, hint, def_weight[i], 1,
+		    URTWM_TX_WEIGHT_MAX);
+	}
+	sc->sc_tx_sched = urtwm_get_tunable(sc, "tx_sched",
+	    URTWM_TX_SCHED_PRIO, 0, URTWM_TX_SCHED_MAX - 1);
+
+	/* Airtime-fair per-station queues in hostap mode (0 - disabled). */
+	sc->sc_tx_airtime = urtwm_get_tunable(sc, "tx_airtime", 1, 0, 1);
+
+	/* Adjust A-MPDU length from Tx reports (0 - peer's limit only). */
+	sc->sc_tx_ampdu_adapt = urtwm_get_tunable(sc, "tx_ampdu_adapt", 1,
+	    0, 1);
+
+	/* Byte queue limits (0 - disabled) and the queueing delay target. */
+	sc->sc_tx_bql_on = urtwm_get_tunable(sc, "tx_bql", 1, 0, 1);
+	sc->sc_tx_bql_target = SBT_1MS * urtwm_get_tunable(sc,
+	    "tx_bql_target", URTWM_TX_BQL_TARGET, 1, 1000);
+
+	/* Hold transfers when the Tx packet buffer is full (0 - disabled). */
+	sc->sc_tx_credit = urtwm_get_tunable(sc, "tx_credit", 1, 0, 1);
+
+	/* Send contiguous frames directly from the mbuf (0 - always copy). */
+	sc->sc_tx_zcopy = urtwm_get_tunable(sc, "tx_zcopy", 1, 0, 1);
+
+	/* NB: newly allocated nodes have zero generation. */
+	sc->sc_tx_tmpl_gen = 1;
 }
 
 static void
@@ -3170,7 +5220,7 @@ urtwm_tx_beacon(struct urtwm_softc *sc, struct urtwm_vap *uvp)
 		return (ENOMEM);
 
 	memcpy(bf->buf, desc, sizeof(*desc));
-	urtwm_tx_start(sc, uvp->bcn_mbuf, IEEE80211_FC0_TYPE_MGT, bf);
+	urtwm_tx_start(sc, NULL, uvp->bcn_mbuf, IEEE80211_FC0_TYPE_MGT, bf);
 
 	return (0);
 }
@@ -3295,8 +5345,11 @@ urtwm_push_nulldata(struct urtwm_softc *sc, struct ieee80211vap *vap)
 	urtwm_reset_beacon_valid(sc, uvp->id);
 
 	data->buflen = required_size;
-	STAILQ_INSERT_TAIL(&sc->sc_tx_pending, data, next);
-	usbd_transfer_start(sc->sc_xfer[URTWM_BULK_TX_VO]);
+	data->qid = URTWM_BULK_TX_VO;
+	STAILQ_INSERT_TAIL(&sc->sc_tx_pending[URTWM_TX_QIDX(data->qid)],
+	    data, next);
+	sc->sc_tx_nbufs[URTWM_TX_QIDX(data->qid)]++;
+	urtwm_tx_kick(sc, data->qid);
 
 	error = urtwm_check_beacon_valid(sc, uvp->id);
 	if (error != 0) {
@@ -3623,6 +5676,7 @@ urtwm_tsf_sync_adhoc_task(void *arg, int pending)
 	/* Disable synchronization. */
 	urtwm_setbits_1(sc, R92C_BCN_CTRL(uvp->id),
 	    0, R92C_BCN_CTRL_DIS_TSF_UDT0);
+	urtwm_tsf_cache_invalidate(sc, uvp->id);
 
 	/* Accept all beacons. */
 	urtwm_set_rx_bssid_all(sc, 1);
@@ -3642,6 +5696,7 @@ urtwm_tsf_sync_enable(struct urtwm_softc *sc, struct ieee80211vap *vap)
 
 	/* Reset TSF. */
 	urtwm_write_1(sc, R92C_DUAL_TSF_RST, R92C_DUAL_TSF_RESET(uvp->id));
+	urtwm_tsf_cache_invalidate(sc, uvp->id);
 
 	switch (vap->iv_opmode) {
 	case IEEE80211_M_STA:
@@ -3685,6 +5740,31 @@ urtwm_get_tsf(struct urtwm_softc *sc, uint64_t *buf, int id)
 	*buf += urtwm_get_tsf_low(sc, id);
 }
 
+/*
+ * Returns an estimate of the current TSF value; the chip is queried
+ * at most once per URTWM_TSF_CACHE_TIMEOUT.
+ */
+static uint64_t
+urtwm_get_tsf_cached(struct urtwm_softc *sc, int id)
+{
+	struct urtwm_tsf_cache *tc = &sc->sc_tsf_cache[id];
+	sbintime_t now;
+
+	now = sbinuptime();
+	if (tc->sbt == 0 || now - tc->sbt > URTWM_TSF_CACHE_TIMEOUT) {
+		urtwm_get_tsf(sc, &tc->tsf, id);
+		tc->sbt = now;
+	}
+
+	return (tc->tsf + sbttous(now - tc->sbt));
+}
+
+static void
+urtwm_tsf_cache_invalidate(struct urtwm_softc *sc, int id)
+{
+	sc->sc_tsf_cache[id].sbt = 0;
+}
+
 static void
 urtwm_r12a_set_led_mini(struct urtwm_softc *sc, int led, int on)
 {
@@ -3836,6 +5916,9 @@ urtwm_newstate(struct ieee80211vap *vap, enum ieee80211_state nstate, int arg)
 	if (ostate == IEEE80211_S_RUN) {
 		sc->vaps_running--;
 
+		/* Stop beacon filtering. */
+		uvp->bcn_skip_max = 0;
+
 		if (vap->iv_opmode == IEEE80211_M_IBSS) {
 			/* Stop periodical TSF synchronization. */
 			callout_stop(&uvp->tsf_sync_adhoc);
@@ -3853,6 +5936,7 @@ urtwm_newstate(struct ieee80211vap *vap, enum ieee80211_state nstate, int arg)
 			/* Reset TSF. */
 			urtwm_write_1(sc, R92C_DUAL_TSF_RST,
 			    R92C_DUAL_TSF_RESET(uvp->id));
+			urtwm_tsf_cache_invalidate(sc, uvp->id);
 		}
 
 #ifndef URTWM_WITHOUT_UCODE
@@ -3893,6 +5977,9 @@ urtwm_newstate(struct ieee80211vap *vap, enum ieee80211_state nstate, int arg)
 	case IEEE80211_S_RUN:
 		ni = ieee80211_ref_node(vap->iv_bss);
 
+		/* Vap Tx parameters may be changed; rebuild Tx templates. */
+		atomic_add_int(&sc->sc_tx_tmpl_gen, 1);
+
 		if (ic->ic_bsschan == IEEE80211_CHAN_ANYC ||
 		    ni->ni_chan == IEEE80211_CHAN_ANYC) {
 			device_printf(sc->sc_dev,
@@ -3932,6 +6019,18 @@ urtwm_newstate(struct ieee80211vap *vap, enum ieee80211_state nstate, int arg)
 		/* Set beacon interval. */
 		urtwm_write_2(sc, R92C_BCN_INTERVAL(uvp->id), ni->ni_intval);
 
+		if (vap->iv_opmode == IEEE80211_M_STA) {
+			/*
+			 * Setup beacon filter; pass at least two beacons
+			 * within the beacon miss threshold.
+			 */
+			IEEE80211_ADDR_COPY(uvp->bcn_bssid, ni->ni_bssid);
+			uvp->bcn_hash_valid = 0;
+			uvp->bcn_skip = 0;
+			uvp->bcn_skip_max = imin(sc->sc_bcn_filter,
+			    vap->iv_bmissthreshold / 2);
+		}
+
 		if (sc->vaps_running == sc->monvaps_running) {
 			/* Enable Rx of data frames. */
 			urtwm_write_2(sc, R92C_RXFLTMAP2, 0xffff);
@@ -4037,6 +6136,94 @@ urtwm_calib_to(void *arg)
 	urtwm_cmd_sleepable(sc, NULL, 0, urtwm_calib_cb);
 }
 
+static void
+urtwm_rxagg_write(struct urtwm_softc *sc, int id)
+{
+	const struct urtwm_rxagg_profile *prof = &urtwm_rxagg_profiles[id];
+
+	URTWM_DPRINTF(sc, URTWM_DEBUG_RECV,
+	    "%s: Rx aggregation profile %d -> %d\n", __func__,
+	    sc->sc_rxagg_cur, id);
+
+	urtwm_write_2(sc, R92C_RXDMA_AGG_PG_TH,
+	    SM(R92C_RXDMA_AGG_PG_TH_SIZE, prof->size) |
+	    SM(R92C_RXDMA_AGG_PG_TH_TIME, prof->time));
+	sc->sc_rxagg_cur = id;
+	sc->sc_rxagg_changes++;
+}
+
+static void
+urtwm_rxagg_to(void *arg)
+{
+	struct urtwm_softc *sc = arg;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	/* Do it in a process context. */
+	urtwm_cmd_sleepable(sc, NULL, 0, urtwm_rxagg_cb);
+	callout_reset(&sc->sc_rxagg_to, hz, urtwm_rxagg_to, sc);
+}
+
+/*
+ * Runs once per second; switches to the next (or previous) profile
+ * depending on the Rx byte rate, frames per transfer and Rx path backlog.
+ */
+static void
+urtwm_rxagg_cb(struct urtwm_softc *sc, union sec_param *data)
+{
+	uint64_t bytes, frames, xfers, dry;
+	int id;
+
+	bytes = sc->sc_rx_bytes - sc->sc_rxagg_prev_bytes;
+	frames = sc->sc_rx_batch_frames - sc->sc_rxagg_prev_frames;
+	xfers = sc->sc_rx_xfers - sc->sc_rxagg_prev_xfers;
+	dry = sc->sc_rx_ring_dry - sc->sc_rxagg_prev_dry;
+	sc->sc_rxagg_prev_bytes = sc->sc_rx_bytes;
+	sc->sc_rxagg_prev_frames = sc->sc_rx_batch_frames;
+	sc->sc_rxagg_prev_xfers = sc->sc_rx_xfers;
+	sc->sc_rxagg_prev_dry = sc->sc_rx_ring_dry;
+
+	id = sc->sc_rxagg_cur;
+	if (sc->sc_rxagg_pin >= 0)
+		id = sc->sc_rxagg_pin;
+	else if (bytes > URTWM_RXAGG_RATE_HIGH || sc->sc_rx_pending_cnt != 0 ||
+	    (dry != 0 && bytes > URTWM_RXAGG_RATE_LOW)) {
+		/* Bulk load or Rx path cannot keep up: bigger aggregates. */
+		id++;
+	} else if (bytes < URTWM_RXAGG_RATE_LOW || frames <= xfers) {
+		/*
+		 * Interactive traffic (or nothing to aggregate):
+		 * flush aggregates sooner.
+		 */
+		id--;
+	}
+	id = MAX(MIN(id, sc->sc_rxagg_max), 0);
+
+	if (id != sc->sc_rxagg_cur)
+		urtwm_rxagg_write(sc, id);
+}
+
+static int
+urtwm_sysctl_rxagg_pin(SYSCTL_HANDLER_ARGS)
+{
+	struct urtwm_softc *sc = arg1;
+	int error, val;
+
+	val = sc->sc_rxagg_pin;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	if (val < -1 || val > sc->sc_rxagg_max)
+		return (EINVAL);
+
+	URTWM_LOCK(sc);
+	sc->sc_rxagg_pin = val;
+	URTWM_UNLOCK(sc);
+
+	return (0);
+}
+
 static void
 urtwm_calib_cb(struct urtwm_softc *sc, union sec_param *data)
 {
@@ -4125,31 +6312,69 @@ urtwm_r21a_get_rssi_cck(struct urtwm_softc *sc, void *physt)
 }
 
 static int8_t
-urtwm_get_rssi_ofdm(struct urtwm_softc *sc, void *physt)
+urtwm_get_rssi_ofdm(struct urtwm_softc *sc, void *physt,
+    struct ieee80211_rx_stats *rxs)
 {
 	struct r12a_rx_phystat *stat = (struct r12a_rx_phystat *)physt;
-	int i, rssi;
+	int i, chain_rssi, rssi;
 
 	rssi = 0;
-	for (i = 0; i < sc->nrxchains; i++)
-		rssi += (stat->gain_trsw[i] & 0x7f) - 110;
+	for (i = 0; i < sc->nrxchains; i++) {
+		chain_rssi = (stat->gain_trsw[i] & 0x7f) - 110;
+		rxs->c_rssi_ctl[i] = chain_rssi - URTWM_NOISE_FLOOR;
+		rxs->c_nf_ctl[i] = URTWM_NOISE_FLOOR;
+		rssi += chain_rssi;
+	}
+	rxs->c_chain = sc->nrxchains;
+	rxs->r_flags |= IEEE80211_R_C_CHAIN | IEEE80211_R_C_NF |
+	    IEEE80211_R_C_RSSI;
 
 	return (rssi / sc->nrxchains);
 }
 
 static int8_t
-urtwm_get_rssi(struct urtwm_softc *sc, int rate, void *physt)
+urtwm_get_rssi(struct urtwm_softc *sc, int rate, void *physt,
+    struct ieee80211_rx_stats *rxs)
 {
 	int8_t rssi;
 
 	if (URTWM_RATE_IS_CCK(rate))
 		rssi = urtwm_get_rssi_cck(sc, physt);
 	else	/* OFDM/HT. */
-		rssi = urtwm_get_rssi_ofdm(sc, physt);
+		rssi = urtwm_get_rssi_ofdm(sc, physt, rxs);
 
 	return (rssi);
 }
 
+static void
+urtwm_update_rxstats(struct urtwm_softc *sc, struct urtwm_node *un,
+    int rate, void *physt, int8_t rssi)
+{
+	struct r12a_rx_phystat *stat = (struct r12a_rx_phystat *)physt;
+	struct urtwm_node_rxstats *rs = &un->rxstats;
+	struct urtwm_rx_chain_stats *cs;
+	int first, i;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	URTWM_EWMA_UPDATE(rs->rssi, rssi, rs->nsamples == 0);
+	rs->nsamples++;
+
+	/* Per-chain values are not available for CCK frames. */
+	if (URTWM_RATE_IS_CCK(rate))
+		return;
+
+	first = (rs->nsamples_ofdm == 0);
+	for (i = 0; i < sc->nrxchains; i++) {
+		cs = &rs->chain[i];
+		URTWM_EWMA_UPDATE(cs->rssi,
+		    (stat->gain_trsw[i] & 0x7f) - 110, first);
+		URTWM_EWMA_UPDATE(cs->snr, (int8_t)stat->rxsnr[i], first);
+		URTWM_EWMA_UPDATE(cs->evm, (int8_t)stat->rxevm[i], first);
+	}
+	rs->nsamples_ofdm++;
+}
+
 static void
 urtwm_tx_protection(struct urtwm_softc *sc, struct r12a_tx_desc *txd,
     enum ieee80211_protmode mode)
@@ -4270,6 +6495,65 @@ urtwm_tx_set_sgi(struct urtwm_softc *sc, struct r12a_tx_desc *txd,
 		txd->txdw5 |= htole32(R12A_TXDW5_SGI);
 }
 
+/*
+ * Returns the Tx descriptor template for unicast data frames to the
+ * node; only per-frame fields (queue, rate, sequence number, A-MPDU
+ * and cipher settings, length) need to be added to it.  The template
+ * is rebuilt when the channel or protection mode changes, and after
+ * sc_tx_tmpl_gen is bumped (association, state change).
+ */
+static const struct r12a_tx_desc *
+urtwm_tx_tmpl_get(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    struct ieee80211_channel *chan, const struct ieee80211_txparam *tp,
+    int ht)
+{
+	struct ieee80211com *ic = &sc->sc_ic;
+	struct urtwm_node *un = URTWM_NODE(ni);
+	struct r12a_tx_desc *txd;
+	int i, prot;
+
+	prot = (ic->ic_flags & IEEE80211_F_USEPROT) ?
+	    ic->ic_protmode : IEEE80211_PROT_NONE;
+	prot |= ic->ic_htprotmode << 4;
+
+	if (un->tx_tmpl_gen == sc->sc_tx_tmpl_gen &&
+	    un->tx_tmpl_chan == chan && un->tx_tmpl_prot == prot)
+		return (&un->tx_tmpl[ht]);
+
+	for (i = 0; i < nitems(un->tx_tmpl); i++) {
+		txd = &un->tx_tmpl[i];
+		memset(txd, 0, sizeof(*txd));
+
+		txd->offset = sizeof(*txd);
+		txd->flags0 = R12A_FLAGS0_LSG | R12A_FLAGS0_FSG |
+		    R12A_FLAGS0_OWN;
+		txd->txdw1 = htole32(SM(R12A_TXDW1_MACID, un->id));
+		txd->txdw2 = htole32(R12A_TXDW2_SPE_RPT);
+		txd->txdw4 = htole32(R12A_TXDW4_RETRY_LMT_ENA);
+		txd->txdw4 |= htole32(SM(R12A_TXDW4_RETRY_LMT, tp->maxretry));
+		/* Data rate fallback limit (max). */
+		txd->txdw4 |= htole32(SM(R12A_TXDW4_DATARATE_FB_LMT, 0x1f));
+		txd->txdw6 = htole32(SM(R21A_TXDW6_MBSSID,
+		    URTWM_VAP(ni->ni_vap)->id));
+		urtwm_tx_raid(sc, txd, ni, 0);
+	}
+
+	/* Legacy rates. */
+	if (ic->ic_flags & IEEE80211_F_USEPROT)
+		urtwm_tx_protection(sc, &un->tx_tmpl[0], ic->ic_protmode);
+
+	/* MCS rates. */
+	urtwm_tx_set_sgi(sc, &un->tx_tmpl[1], ni);
+	urtwm_tx_protection(sc, &un->tx_tmpl[1], ic->ic_htprotmode);
+
+	un->tx_tmpl_gen = sc->sc_tx_tmpl_gen;
+	un->tx_tmpl_chan = chan;
+	un->tx_tmpl_prot = prot;
+	sc->sc_tx_tmpl_builds++;
+
+	return (&un->tx_tmpl[ht]);
+}
+
 static int
 urtwm_tx_data(struct urtwm_softc *sc, struct ieee80211_node *ni,
     struct mbuf *m, struct urtwm_data *data)
@@ -4282,8 +6566,9 @@ urtwm_tx_data(struct urtwm_softc *sc, struct ieee80211_node *ni,
 	struct ieee80211_channel *chan;
 	struct ieee80211_frame *wh;
 	struct r12a_tx_desc *txd;
+	struct urtwm_node *un;
 	uint8_t macid, rate, ridx, type, tid, qos, qsel;
-	int hasqos, ismcast;
+	int density, hasqos, ismcast, maxagg;
 
 	URTWM_ASSERT_LOCKED(sc);
 
@@ -4344,59 +6629,60 @@ urtwm_tx_data(struct urtwm_softc *sc, struct ieee80211_node *ni,
 	}
 
 	/* Fill Tx descriptor. */
-	txd = (struct r12a_tx_desc *)data->buf;
-	memset(txd, 0, sizeof(*txd));
-
-	txd->offset = sizeof(*txd);
-	txd->flags0 = R12A_FLAGS0_LSG | R12A_FLAGS0_FSG | R12A_FLAGS0_OWN;
-	if (ismcast)
-		txd->flags0 |= R12A_FLAGS0_BMCAST;
-
-	if (!ismcast) {
-		/* Unicast frame, check if an ACK is expected. */
-		if (!qos || (qos & IEEE80211_QOS_ACKPOLICY) !=
+	txd = URTWM_TX_DESC_NEXT(data);
+	if (!ismcast && type == IEEE80211_FC0_TYPE_DATA) {
+		/* Unicast data frame: start from the per-node template. */
+		memcpy(txd, urtwm_tx_tmpl_get(sc, ni, chan, tp,
+		    ridx >= URTWM_RIDX_MCS(0)), sizeof(*txd));
+
+		/* Check if an ACK is expected. */
+		if ((qos & IEEE80211_QOS_ACKPOLICY) ==
 		    IEEE80211_QOS_ACKPOLICY_NOACK) {
-			txd->txdw4 = htole32(R12A_TXDW4_RETRY_LMT_ENA);
-			txd->txdw4 |= htole32(SM(R12A_TXDW4_RETRY_LMT,
-			    tp->maxretry));
+			txd->txdw4 &= ~htole32(R12A_TXDW4_RETRY_LMT_ENA |
+			    R12A_TXDW4_RETRY_LMT_M);
 		}
 
-		struct urtwm_node *un = URTWM_NODE(ni);
-		macid = un->id;
+		qsel = tid % URTWM_MAX_TID;
 
-		if (type == IEEE80211_FC0_TYPE_DATA) {
-			qsel = tid % URTWM_MAX_TID;
+		if (m->m_flags & M_AMPDU_MPDU) {
+			maxagg = urtwm_tx_ampdu_params(sc, ni,
+			    m->m_pkthdr.len, &density);
+			txd->txdw2 |= htole32(R12A_TXDW2_AGGEN);
+			txd->txdw2 |= htole32(SM(R12A_TXDW2_AMPDU_DEN,
+			    density));
+			txd->txdw3 |= htole32(SM(R12A_TXDW3_MAX_AGG,
+			    maxagg));
+		} else
+			txd->txdw2 |= htole32(R12A_TXDW2_AGGBK);
 
-			if (m->m_flags & M_AMPDU_MPDU) {
-				txd->txdw2 |= htole32(R12A_TXDW2_AGGEN);
-				txd->txdw2 |= htole32(SM(R12A_TXDW2_AMPDU_DEN,
-				    vap->iv_ampdu_density));
-				txd->txdw3 |= htole32(SM(R12A_TXDW3_MAX_AGG,
-				    0x1f));	/* XXX */
-			} else
-				txd->txdw2 |= htole32(R12A_TXDW2_AGGBK);
-
-			txd->txdw2 |= htole32(R12A_TXDW2_SPE_RPT);
-			if (sc->sc_flags & URTWM_FW_LOADED)
-				sc->sc_tx_n_active++;
-
-			if (ridx >= URTWM_RIDX_MCS(0))
-				urtwm_tx_set_sgi(sc, txd, ni);
-
-			if (rate & IEEE80211_RATE_MCS) {
-				urtwm_tx_protection(sc, txd,
-				    ic->ic_htprotmode);
-			} else if (ic->ic_flags & IEEE80211_F_USEPROT)
-				urtwm_tx_protection(sc, txd, ic->ic_protmode);
-
-			/* Data rate fallback limit (max). */
-			txd->txdw4 |= htole32(SM(R12A_TXDW4_DATARATE_FB_LMT,
-			    0x1f));
-		} else	/* IEEE80211_FC0_TYPE_MGT */
-			qsel = R12A_TXDW1_QSEL_MGNT;
+		if (sc->sc_flags & URTWM_FW_LOADED)
+			sc->sc_tx_n_active++;
 	} else {
-		macid = URTWM_MACID_BC;
+		memset(txd, 0, sizeof(*txd));
+
+		txd->offset = sizeof(*txd);
+		txd->flags0 = R12A_FLAGS0_LSG | R12A_FLAGS0_FSG |
+		    R12A_FLAGS0_OWN;
+
+		if (!ismcast) {		/* IEEE80211_FC0_TYPE_MGT */
+			/* Unicast frame, check if an ACK is expected. */
+			if (!qos || (qos & IEEE80211_QOS_ACKPOLICY) !=
+			    IEEE80211_QOS_ACKPOLICY_NOACK) {
+				txd->txdw4 = htole32(R12A_TXDW4_RETRY_LMT_ENA);
+				txd->txdw4 |= htole32(SM(R12A_TXDW4_RETRY_LMT,
+				    tp->maxretry));
+			}
+
+			macid = URTWM_NODE(ni)->id;
+		} else {
+			txd->flags0 |= R12A_FLAGS0_BMCAST;
+			macid = URTWM_MACID_BC;
+		}
 		qsel = R12A_TXDW1_QSEL_MGNT;
+
+		txd->txdw1 |= htole32(SM(R12A_TXDW1_MACID, macid));
+		txd->txdw6 |= htole32(SM(R21A_TXDW6_MBSSID, uvp->id));
+		urtwm_tx_raid(sc, txd, ni, ismcast);
 	}
 
 	txd->txdw1 |= htole32(SM(R12A_TXDW1_QSEL, qsel));
@@ -4404,10 +6690,7 @@ urtwm_tx_data(struct urtwm_softc *sc, struct ieee80211_node *ni,
 	/* XXX TODO: 40MHZ flag? */
 	/* XXX Short preamble? */
 
-	txd->txdw1 |= htole32(SM(R12A_TXDW1_MACID, macid));
 	txd->txdw4 |= htole32(SM(R12A_TXDW4_DATARATE, ridx));
-	txd->txdw6 |= htole32(SM(R21A_TXDW6_MBSSID, uvp->id));
-	urtwm_tx_raid(sc, txd, ni, ismcast);
 
 	/* Force this rate if needed. */
 	if (URTWM_USE_RATECTL(sc) || ismcast ||
@@ -4465,9 +6748,15 @@ urtwm_tx_data(struct urtwm_softc *sc, struct ieee80211_node *ni,
 		ieee80211_radiotap_tx(vap, m);
 	}
 
-	data->ni = ni;
+	if (m->m_flags & M_AMPDU_MPDU) {
+		/* NB: the frame will be sent now; wait for its report. */
+		un = URTWM_NODE(ni);
+		un->agg_frames++;
+		un->agg_limit_sum += maxagg;
+		un->agg_pending[qsel]++;
+	}
 
-	urtwm_tx_start(sc, m, type, data);
+	urtwm_tx_start(sc, ni, m, type, data);
 
 	return (0);
 }
@@ -4518,7 +6807,7 @@ urtwm_tx_raw(struct urtwm_softc *sc, struct ieee80211_node *ni,
 	ismcast = IEEE80211_IS_MULTICAST(wh->i_addr1);
 
 	/* Fill Tx descriptor. */
-	txd = (struct r12a_tx_desc *)data->buf;
+	txd = URTWM_TX_DESC_NEXT(data);
 	memset(txd, 0, sizeof(*txd));
 
 	txd->offset = sizeof(*txd);
@@ -4569,51 +6858,127 @@ urtwm_tx_raw(struct urtwm_softc *sc, struct ieee80211_node *ni,
 		ieee80211_radiotap_tx(vap, m);
 	}
 
-	data->ni = ni;
+	urtwm_tx_start(sc, ni, m, type, data);
+
+	return (0);
+}
+
+static int
+urtwm_tx_qid(struct mbuf *m)
+{
+	const struct ieee80211_frame *wh;
+
+	wh = mtod(m, const struct ieee80211_frame *);
+	switch (wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK) {
+	case IEEE80211_FC0_TYPE_CTL:
+	case IEEE80211_FC0_TYPE_MGT:
+		return (URTWM_BULK_TX_VO);
+	default:
+		return (wme2queue[M_WME_GETAC(m)].qid);
+	}
+}
+
+/*
+ * Checks if the frame can be sent without copying it into data->buf:
+ * it must start a new transfer, be contiguous and have enough writable
+ * headroom for the Tx descriptor.  When another transfer is already
+ * waiting for this queue, the frame is copied instead, so subsequent
+ * frames can still be appended to it.
+ */
+static int
+urtwm_tx_zcopy_ok(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    struct mbuf *m, struct urtwm_data *data)
+{
 
-	urtwm_tx_start(sc, m, type, data);
+	if (!sc->sc_tx_zcopy || ni == NULL || data->aggnum != 0)
+		return (0);
+	if (m->m_next != NULL ||
+	    M_LEADINGSPACE(m) < sizeof(struct r12a_tx_desc))
+		return (0);
+	if (sc->sc_tx_agg_max > 1 &&
+	    !STAILQ_EMPTY(&sc->sc_tx_pending[URTWM_TX_QIDX(urtwm_tx_qid(m))]))
+		return (0);
 
-	return (0);
+	return (1);
 }
 
 static void
-urtwm_tx_start(struct urtwm_softc *sc, struct mbuf *m, uint8_t type,
-    struct urtwm_data *data)
+urtwm_tx_start(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    struct mbuf *m, uint8_t type, struct urtwm_data *data)
 {
-	struct usb_xfer *xfer;
-	struct r12a_tx_desc *txd;
+	struct r12a_tx_desc *txd, *txd0;
 	uint16_t ac;
-	int xferlen;
 
 	URTWM_ASSERT_LOCKED(sc);
 
 	ac = M_WME_GETAC(m);
 
+	txd = URTWM_TX_DESC_NEXT(data);
+	txd->pktlen = htole16(m->m_pkthdr.len);
+
+	/* Compute Tx descriptor checksum. */
+	urtwm_tx_checksum(txd);
+
+	/* NB: beacons are stored in the reserved (BCNQ) area. */
+	if (ni != NULL) {
+		data->npages += howmany(sizeof(*txd) + m->m_pkthdr.len,
+		    sc->page_size);
+	}
+
+	if (urtwm_tx_zcopy_ok(sc, ni, m, data)) {
+		/*
+		 * Put the descriptor right before the frame and submit
+		 * the mbuf storage itself; the mbuf is kept in data->m
+		 * until the transfer completes.
+		 */
+		data->txbuf = mtod(m, uint8_t *) - sizeof(*txd);
+		memcpy(data->txbuf, txd, sizeof(*txd));
+		data->buflen = sizeof(*txd) + m->m_pkthdr.len;
+		sc->sc_tx_zcopy_frames++;
+	} else {
+		m_copydata(m, 0, m->m_pkthdr.len, (caddr_t)&txd[1]);
+		data->buflen = (uint8_t *)&txd[1] - data->buf +
+		    m->m_pkthdr.len;
+		sc->sc_tx_copy_frames++;
+		sc->sc_tx_copy_bytes += m->m_pkthdr.len;
+	}
+
+	if (data->aggnum++ != 0) {
+		struct mbuf *mlast;
+
+		/* Appended to a pending transfer (see urtwm_tx_getbuf()). */
+		m->m_pkthdr.rcvif = (void *)ni;
+		for (mlast = data->m; mlast->m_nextpkt != NULL;
+		    mlast = mlast->m_nextpkt);
+		mlast->m_nextpkt = m;
+
+		/* Update the number of frames in the first descriptor. */
+		txd0 = (struct r12a_tx_desc *)data->buf;
+		txd0->flags7 &= ~htole16(R12A_FLAGS7_AGGNUM_M);
+		txd0->flags7 |= htole16(SM(R12A_FLAGS7_AGGNUM, data->aggnum));
+		urtwm_tx_checksum(txd0);
+		return;
+	}
+
 	switch (type) {
 	case IEEE80211_FC0_TYPE_CTL:
 	case IEEE80211_FC0_TYPE_MGT:
-		xfer = sc->sc_xfer[URTWM_BULK_TX_VO];
+		data->qid = URTWM_BULK_TX_VO;
 		break;
 	default:
-		xfer = sc->sc_xfer[wme2queue[ac].qid];
+		data->qid = wme2queue[ac].qid;
 		break;
 	}
 
-	txd = (struct r12a_tx_desc *)data->buf;
-	txd->pktlen = htole16(m->m_pkthdr.len);
-
-	/* Compute Tx descriptor checksum. */
-	urtwm_tx_checksum(txd);
-
-	xferlen = sizeof(*txd) + m->m_pkthdr.len;
-	m_copydata(m, 0, m->m_pkthdr.len, (caddr_t)&txd[1]);
-
-	data->buflen = xferlen;
-	if (data->ni != NULL)
+	data->ni = ni;
+	if (ni != NULL)
 		data->m = m;
+	data->qsbt = sbinuptime();
 
-	STAILQ_INSERT_TAIL(&sc->sc_tx_pending, data, next);
-	usbd_transfer_start(xfer);
+	STAILQ_INSERT_TAIL(&sc->sc_tx_pending[URTWM_TX_QIDX(data->qid)],
+	    data, next);
+	sc->sc_tx_nbufs[URTWM_TX_QIDX(data->qid)]++;
+	urtwm_tx_kick(sc, data->qid);
 }
 
 static void
@@ -4623,57 +6988,489 @@ urtwm_tx_checksum(struct r12a_tx_desc *txd)
 	int i;
 
 	/* NB: checksum calculation takes into account only first 32 bytes. */
+	txd->txdsum = 0;
 	for (i = 0; i < 32 / 2; i++)
 		sum ^= ((uint16_t *)txd)[i];
 	txd->txdsum = sum;	/* NB: already little endian. */
 }
 
+/*
+ * Frames are put into a multi-producer ring without taking sc_mtx;
+ * the ring is drained into per-AC queues by urtwm_start(), either
+ * directly (when the lock is not contended) or from urtwm_tx_task().
+ */
 static int
 urtwm_transmit(struct ieee80211com *ic, struct mbuf *m)
 {
 	struct urtwm_softc *sc = ic->ic_softc;
 	int error;
 
-	URTWM_LOCK(sc);
-	if ((sc->sc_flags & URTWM_RUNNING) == 0) {
-		URTWM_UNLOCK(sc);
+	if ((sc->sc_flags & URTWM_RUNNING) == 0)
 		return (ENXIO);
+
+	error = buf_ring_enqueue(sc->sc_tx_ring, m);
+	if (error != 0) {
+		counter_u64_add(sc->sc_tx_ring_drops, 1);
+		return (error);
 	}
-	error = mbufq_enqueue(&sc->sc_snd, m);
-	if (error) {
+
+	if (URTWM_TRYLOCK(sc)) {
+		if (sc->sc_flags & URTWM_RUNNING)
+			urtwm_start(sc);
+		else	/* raced with urtwm_stop() */
+			urtwm_drain_mbufq(sc);
 		URTWM_UNLOCK(sc);
-		return (error);
+	} else {
+		/* The lock owner may already be past urtwm_start(). */
+		counter_u64_add(sc->sc_tx_lock_busy, 1);
+		ieee80211_runtask(ic, &sc->sc_tx_task);
 	}
-	urtwm_start(sc);
-	URTWM_UNLOCK(sc);
 
 	return (0);
 }
 
+static void
+urtwm_tx_task(void *arg, int pending)
+{
+	struct urtwm_softc *sc = arg;
+
+	URTWM_LOCK(sc);
+	sc->sc_tx_task_runs++;
+	if (sc->sc_flags & URTWM_RUNNING)
+		urtwm_start(sc);
+	else
+		urtwm_drain_mbufq(sc);
+	URTWM_UNLOCK(sc);
+}
+
+/*
+ * Estimates the airtime (usec) needed to send a frame once at the given
+ * rate index (preamble, payload, SIFS and ACK; roughly).
+ */
+static int
+urtwm_tx_airtime(struct ieee80211_node *ni, int len, int ridx)
+{
+	const struct ieee80211_mcs_rates *mcs;
+	int ovh, rate;
+
+	if (ridx >= URTWM_RIDX_MCS(0) && ridx <= URTWM_RIDX_MCS(15)) {
+		mcs = &ieee80211_htrates[ridx - URTWM_RIDX_MCS(0)];
+		if (ni->ni_chan != IEEE80211_CHAN_ANYC &&
+		    IEEE80211_IS_CHAN_HT40(ni->ni_chan))
+			rate = mcs->ht40_rate_800ns;
+		else
+			rate = mcs->ht20_rate_800ns;
+		ovh = URTWM_TX_AIRTIME_OVH_HT;
+	} else {
+		if (ridx > URTWM_RIDX_OFDM54)	/* unknown or VHT */
+			ridx = URTWM_RIDX_OFDM6;
+		rate = ridx2rate[ridx];
+		if (ridx <= URTWM_RIDX_CCK11)
+			ovh = URTWM_TX_AIRTIME_OVH_CCK;
+		else
+			ovh = URTWM_TX_AIRTIME_OVH_OFDM;
+	}
+
+	/* NB: rates are in 500 Kbps units. */
+	return (ovh + len * 16 / rate);
+}
+
+/*
+ * Moves a frame from sc_tx_ring to the software queue: unicast data
+ * frames for stations of a hostap vap are queued per station (see
+ * urtwm_tx_ac_first()), everything else goes to sc_snd.
+ */
+static void
+urtwm_tx_enqueue(struct urtwm_softc *sc, struct mbuf *m)
+{
+	struct urtwm_tx_ac_stats *stats;
+	struct ieee80211_node *ni;
+	struct ieee80211vap *vap;
+	struct ieee80211_frame *wh;
+	struct urtwm_node *un;
+	struct mbufq *mq;
+	int qidx;
+
+	ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
+	vap = ni->ni_vap;
+	wh = mtod(m, struct ieee80211_frame *);
+	qidx = URTWM_TX_QIDX(urtwm_tx_qid(m));
+	stats = &sc->sc_tx_ac[qidx];
+
+	un = NULL;
+	if (sc->sc_tx_airtime && vap->iv_opmode == IEEE80211_M_HOSTAP &&
+	    ni != vap->iv_bss && !IEEE80211_IS_MULTICAST(wh->i_addr1) &&
+	    (wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK) ==
+	    IEEE80211_FC0_TYPE_DATA) {
+		un = URTWM_NODE(ni);
+		mq = &un->tx_q[qidx];
+	} else
+		mq = &sc->sc_snd[qidx];
+
+	if (mbufq_enqueue(mq, m) != 0) {
+		stats->drops++;
+		if (un != NULL)
+			un->tx_drops++;
+		m->m_pkthdr.rcvif = NULL;
+		ieee80211_tx_complete(ni, m, 1);
+		return;
+	}
+
+	if (un != NULL) {
+		if (!(un->tx_active & (1 << qidx))) {
+			TAILQ_INSERT_TAIL(&sc->sc_tx_nodes[qidx], un,
+			    tx_next[qidx]);
+			un->tx_active |= 1 << qidx;
+		}
+		sc->sc_tx_nq_len[qidx]++;
+	}
+	if (stats->qlen_max < urtwm_tx_ac_len(sc, qidx))
+		stats->qlen_max = urtwm_tx_ac_len(sc, qidx);
+}
+
+/*
+ * Drops frames from per-station queues (for the vap or for all vaps).
+ */
+static void
+urtwm_tx_nq_flush(struct urtwm_softc *sc, struct ieee80211vap *vap)
+{
+	struct urtwm_node *un, *tmp;
+	struct ieee80211_node *ni;
+	struct mbuf *m, *next;
+	int i;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	for (i = 0; i < WME_NUM_AC; i++) {
+		TAILQ_FOREACH_SAFE(un, &sc->sc_tx_nodes[i], tx_next[i], tmp) {
+			if (vap != NULL && un->ni.ni_vap != vap)
+				continue;
+
+			TAILQ_REMOVE(&sc->sc_tx_nodes[i], un, tx_next[i]);
+			un->tx_active &= ~(1 << i);
+			sc->sc_tx_nq_len[i] -= mbufq_len(&un->tx_q[i]);
+
+			/* NB: the last frame may hold the last reference. */
+			m = mbufq_flush(&un->tx_q[i]);
+			for (; m != NULL; m = next) {
+				next = m->m_nextpkt;
+				m->m_nextpkt = NULL;
+				ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
+				m->m_pkthdr.rcvif = NULL;
+				ieee80211_free_node(ni);
+				m_freem(m);
+			}
+		}
+	}
+}
+
+/*
+ * Charges retransmissions from the Tx report to the station;
+ * urtwm_tx_ac_dequeue() assumes that every frame is sent only once.
+ */
+static void
+urtwm_tx_airtime_report(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    const struct r12a_c2h_tx_rpt *rpt, int ntries)
+{
+	struct urtwm_node *un = URTWM_NODE(ni);
+	int airtime, qidx, qsel;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	qsel = MS(rpt->txrptb0, R12A_TXRPTB0_QSEL);
+	if (ntries == 0 || qsel >= URTWM_MAX_TID || un->tx_frames == 0)
+		return;
+
+	qidx = TID_TO_WME_AC(qsel);
+	airtime = ntries * urtwm_tx_airtime(ni,
+	    URTWM_EWMA_GET(un->tx_len_avg), rpt->final_rate);
+	un->tx_airtime_retry += airtime;
+	un->tx_deficit[qidx] = imax(un->tx_deficit[qidx] - airtime,
+	    -URTWM_TX_AIRTIME_DEBT_MAX);
+}
+
+/*
+ * Returns the maximum number of A-MPDU subframes for the frame and
+ * the MPDU density.  The peer's limits (maximum A-MPDU length and
+ * minimum MPDU start spacing) are always honoured; the number of
+ * subframes is further limited by urtwm_tx_ampdu_report().
+ */
+static int
+urtwm_tx_ampdu_params(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    int len, int *density)
+{
+	struct urtwm_node *un = URTWM_NODE(ni);
+	int maxagg, maxlen;
+
+	/* NB: iv_ampdu_density is our own (Rx) requirement. */
+	*density = (ni->ni_htparam & IEEE80211_HTCAP_MPDUDENSITY) >>
+	    IEEE80211_HTCAP_MPDUDENSITY_S;
+
+	/* 8 KiB - 1 ... 64 KiB - 1 */
+	maxlen = (8192 << ((ni->ni_htparam & IEEE80211_HTCAP_MAXRXAMPDU) >>
+	    IEEE80211_HTCAP_MAXRXAMPDU_S)) - 1;
+	maxagg = imin(maxlen / imax(len, 1), URTWM_AMPDU_MAX_AGG);
+	if (sc->sc_tx_ampdu_adapt)
+		maxagg = imin(maxagg, un->agg_limit);
+
+	return (imax(maxagg, 1));
+}
+
+/*
+ * Adjusts the A-MPDU length for the node: the subframe limit is halved
+ * when frames are dropped or retried too often (per URTWM_AMPDU_WINDOW
+ * reports) and grows by one subframe while the link is clean.
+ */
+static void
+urtwm_tx_ampdu_report(struct urtwm_softc *sc, struct ieee80211_node *ni,
+    const struct r12a_c2h_tx_rpt *rpt, int ntries)
+{
+	struct urtwm_node *un = URTWM_NODE(ni);
+	int qsel, ratio;
+
+	URTWM_ASSERT_LOCKED(sc);
+
+	/*
+	 * NB: every unicast data frame is reported; take only
+	 * reports for TIDs with aggregated frames in flight.
+	 */
+	qsel = MS(rpt->txrptb0, R12A_TXRPTB0_QSEL);
+	if (qsel >= URTWM_MAX_TID || un->agg_pending[qsel] == 0)
+		return;
+	un->agg_pending[qsel]--;
+
+	un->agg_retries += ntries;
+	un->agg_win_retries += ntries;
+	if (rpt->txrptb0 & (R12A_TXRPTB0_RETRY_OVER |
+	    R12A_TXRPTB0_LIFE_EXPIRE)) {
+		un->agg_fails++;
+		un->agg_win_fails++;
+	}
+	if (++un->agg_win_rpts < URTWM_AMPDU_WINDOW)
+		return;
+
+	ratio = un->agg_win_retries * 100 / un->agg_win_rpts;
+	if (un->agg_win_fails != 0 || ratio >= URTWM_AMPDU_RETRY_HI) {
+		if (un->agg_limit > 1) {
+			un->agg_limit /= 2;
+			un->agg_shrinks++;
+		}
+	} else if (ratio <= URTWM_AMPDU_RETRY_LO) {
+		if (un->agg_limit < URTWM_AMPDU_MAX_AGG) {
+			un->agg_limit++;
+			un->agg_grows++;
+		}
+	}
+
+	un->agg_win_rpts = 0;
+	un->agg_win_retries = 0;
+	un->agg_win_fails = 0;
+}
+
+/*
+ * Returns the next frame to be sent from the AC: sc_snd is served
+ * first, then per-station queues in deficit round robin order.
+ * Deficits are kept in usec of airtime, so slow stations cannot
+ * starve fast ones.
+ */
+static struct mbuf *
+urtwm_tx_ac_first(struct urtwm_softc *sc, int qidx)
+{
+	struct urtwm_node *un;
+	struct mbuf *m;
+
+	m = mbufq_first(&sc->sc_snd[qidx]);
+	if (m != NULL)
+		return (m);
+
+	/* NB: terminates, since the debt is limited. */
+	while ((un = TAILQ_FIRST(&sc->sc_tx_nodes[qidx])) != NULL) {
+		if (un->tx_deficit[qidx] > 0)
+			return (mbufq_first(&un->tx_q[qidx]));
+
+		un->tx_deficit[qidx] += URTWM_TX_AIRTIME_QUANTUM;
+		TAILQ_REMOVE(&sc->sc_tx_nodes[qidx], un, tx_next[qidx]);
+		TAILQ_INSERT_TAIL(&sc->sc_tx_nodes[qidx], un, tx_next[qidx]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Dequeues the frame returned by urtwm_tx_ac_first() and charges
+ * its estimated airtime to the station.
+ */
+static struct mbuf *
+urtwm_tx_ac_dequeue(struct urtwm_softc *sc, int qidx)
+{
+	struct urtwm_node *un;
+	struct mbuf *m;
+	int airtime, len;
+
+	m = mbufq_dequeue(&sc->sc_snd[qidx]);
+	if (m != NULL)
+		return (m);
+
+	un = TAILQ_FIRST(&sc->sc_tx_nodes[qidx]);
+	if (un == NULL)
+		return (NULL);
+
+	m = mbufq_dequeue(&un->tx_q[qidx]);
+	sc->sc_tx_nq_len[qidx]--;
+
+	len = m->m_pkthdr.len;
+	airtime = urtwm_tx_airtime(&un->ni, len, rate2ridx(un->ni.ni_txrate));
+	un->tx_deficit[qidx] = imax(un->tx_deficit[qidx] - airtime,
+	    -URTWM_TX_AIRTIME_DEBT_MAX);
+	un->tx_airtime += airtime;
+	URTWM_EWMA_UPDATE(un->tx_len_avg, len, un->tx_frames == 0);
+	un->tx_frames++;
+
+	if (mbufq_len(&un->tx_q[qidx]) == 0) {
+		/* Keep the debt (if any) until the next activation. */
+		if (un->tx_deficit[qidx] > 0)
+			un->tx_deficit[qidx] = 0;
+		TAILQ_REMOVE(&sc->sc_tx_nodes[qidx], un, tx_next[qidx]);
+		un->tx_active &= ~(1 << qidx);
+	}
+
+	return (m);
+}
+
+static int
+urtwm_tx_ac_len(struct urtwm_softc *sc, int qidx)
+{
+	return (mbufq_len(&sc->sc_snd[qidx]) + sc->sc_tx_nq_len[qidx]);
+}
+
+/*
+ * Selects the next software queue to be served (strict priority).
+ */
+static int
+urtwm_tx_sched_prio(struct urtwm_softc *sc, int blocked)
+{
+	static const int prio[WME_NUM_AC] =
+	    { WME_AC_VO, WME_AC_VI, WME_AC_BE, WME_AC_BK };
+	int i;
+
+	for (i = 0; i < WME_NUM_AC; i++) {
+		if (!(blocked & (1 << prio[i])) &&
+		    urtwm_tx_ac_first(sc, prio[i]) != NULL)
+			return (prio[i]);
+	}
+
+	return (-1);
+}
+
+/*
+ * Selects the next software queue to be served (deficit round robin;
+ * the caller charges the frame length to sc_tx_deficit[]).
+ */
+static int
+urtwm_tx_sched_drr(struct urtwm_softc *sc, int blocked)
+{
+	struct mbuf *m;
+	int i, qidx;
+
+	/* Check if there is anything to send. */
+	for (i = 0; i < WME_NUM_AC; i++) {
+		if (!(blocked & (1 << i)) &&
+		    urtwm_tx_ac_first(sc, i) != NULL)
+			break;
+	}
+	if (i == WME_NUM_AC)
+		return (-1);
+
+	/* NB: terminates, since the deficit grows on every visit. */
+	for (;;) {
+		qidx = sc->sc_tx_drr_cur;
+		m = urtwm_tx_ac_first(sc, qidx);
+		if (m == NULL)
+			sc->sc_tx_deficit[qidx] = 0;
+		else if (!(blocked & (1 << qidx))) {
+			if (!sc->sc_tx_drr_visit) {
+				sc->sc_tx_deficit[qidx] +=
+				    sc->sc_tx_quantum[qidx];
+				sc->sc_tx_drr_visit = 1;
+			}
+			if (sc->sc_tx_deficit[qidx] >= m->m_pkthdr.len)
+				return (qidx);
+		}
+
+		sc->sc_tx_drr_cur = (qidx + 1) % WME_NUM_AC;
+		sc->sc_tx_drr_visit = 0;
+	}
+}
+
 static void
 urtwm_start(struct urtwm_softc *sc)
 {
+	struct urtwm_tx_bql *bql;
 	struct ieee80211_node *ni;
 	struct mbuf *m;
 	struct urtwm_data *bf;
+	int blocked, len, qidx;
 
 	URTWM_ASSERT_LOCKED(sc);
-	while ((m = mbufq_dequeue(&sc->sc_snd)) != NULL) {
-		bf = urtwm_getbuf(sc);
-		if (bf == NULL) {
-			mbufq_prepend(&sc->sc_snd, m);
+
+	/* Move new frames to per-AC (and per-station) queues. */
+	while ((m = buf_ring_dequeue_sc(sc->sc_tx_ring)) != NULL)
+		urtwm_tx_enqueue(sc, m);
+
+	blocked = 0;
+	for (;;) {
+		if (sc->sc_tx_sched == URTWM_TX_SCHED_DRR)
+			qidx = urtwm_tx_sched_drr(sc, blocked);
+		else
+			qidx = urtwm_tx_sched_prio(sc, blocked);
+		if (qidx == -1)
 			break;
+
+		bql = &sc->sc_tx_bql[qidx];
+		if (sc->sc_tx_bql_on && bql->inflight >= bql->limit) {
+			/* Keep the rest in the software queue. */
+			bql->throttled++;
+			blocked |= 1 << qidx;
+			continue;
+		}
+
+		m = urtwm_tx_ac_first(sc, qidx);
+		bf = urtwm_tx_getbuf(sc, m);
+		if (bf == NULL) {
+			/* Try other queues. */
+			blocked |= 1 << qidx;
+			continue;
 		}
+		m = urtwm_tx_ac_dequeue(sc, qidx);
+		len = m->m_pkthdr.len;
+		sc->sc_tx_deficit[qidx] -= len;
+
 		ni = (struct ieee80211_node *)m->m_pkthdr.rcvif;
 		m->m_pkthdr.rcvif = NULL;
 
 		URTWM_DPRINTF(sc, URTWM_DEBUG_XMIT,
 		    "%s: called; m %p, ni %p\n", __func__, m, ni);
 
+		/*
+		 * NB: the transfer may be started (and completed)
+		 * by urtwm_tx_data(); account the frame before that.
+		 */
+		if (sc->sc_tx_bql_on) {
+			bf->bql_bytes += len;
+			bql->inflight += len;
+		}
+
 		if (urtwm_tx_data(sc, ni, m, bf) != 0) {
+			if (sc->sc_tx_bql_on) {
+				bf->bql_bytes -= len;
+				bql->inflight -= len;
+			}
 			if_inc_counter(ni->ni_vap->iv_ifp,
 			    IFCOUNTER_OERRORS, 1);
-			STAILQ_INSERT_HEAD(&sc->sc_tx_inactive, bf, next);
+			/* NB: pending buffer was not modified. */
+			if (bf->aggnum == 0)
+				STAILQ_INSERT_HEAD(&sc->sc_tx_inactive, bf,
+				    next);
 			m_freem(m);
 #ifdef D4054
 			ieee80211_tx_watchdog_refresh(ni->ni_ic, -1, 0);
@@ -4726,6 +7523,10 @@ urtwm_ioctl_net(struct ieee80211com *ic, u_long cmd, void *data)
 		rxmask = ifr->ifr_reqcap & (IFCAP_RXCSUM | IFCAP_RXCSUM_IPV6);
 
 		URTWM_LOCK(sc);
+		if (!(sc->sc_flags & URTWM_RXLRO_EN) ^
+		    !(ifr->ifr_reqcap & IFCAP_LRO))
+			sc->sc_flags ^= URTWM_RXLRO_EN;
+
 		changed = 0;
 		if (!(sc->sc_flags & URTWM_RXCKSUM_EN) ^
 		    !(ifr->ifr_reqcap & IFCAP_RXCSUM)) {
@@ -4754,8 +7555,10 @@ urtwm_ioctl_net(struct ieee80211com *ic, u_long cmd, void *data)
 			struct ifnet *ifp = vap->iv_ifp;
 
 			ifp->if_capenable &=
-			    ~(IFCAP_RXCSUM | IFCAP_RXCSUM_IPV6);
+			    ~(IFCAP_RXCSUM | IFCAP_RXCSUM_IPV6 | IFCAP_LRO);
 			ifp->if_capenable |= rxmask;
+			ifp->if_capenable |= ifr->ifr_reqcap &
+			    ifp->if_capabilities & IFCAP_LRO;
 		}
 		IEEE80211_UNLOCK(ic);
 		break;
@@ -5471,6 +8274,8 @@ urtwm_dma_init(struct urtwm_softc *sc)
 	    SM(R92C_RQPN_LPQ, haslq ? nqpages : 0) |
 	    /* Load values. */
 	    R92C_RQPN_LD));
+	urtwm_tx_pg_init(sc, nqpages + nrempages, hasnq ? nqpages : 0,
+	    haslq ? nqpages : 0);
 
 	/* Initialize TX buffer boundary. */
 	URTWM_CHK(urtwm_write_1(sc, R92C_TXPKTBUF_BCNQ_BDNY, sc->tx_boundary));
@@ -6385,6 +9190,7 @@ urtwm_set_channel(struct ieee80211com *ic)
 
 	URTWM_LOCK(sc);
 	urtwm_set_chan(sc, c);
+	atomic_add_int(&sc->sc_tx_tmpl_gen, 1);
 	sc->sc_rxtap.wr_chan_freq = htole16(c->ic_freq);
 	sc->sc_rxtap.wr_chan_flags = htole16(c->ic_flags);
 	sc->sc_txtap.wt_chan_freq = htole16(c->ic_freq);
@@ -6614,6 +9420,7 @@ urtwm_node_alloc(struct ieee80211vap *vap,
     const uint8_t mac[IEEE80211_ADDR_LEN])
 {
 	struct urtwm_node *un;
+	int i;
 
 	un = malloc(sizeof (struct urtwm_node), M_80211_NODE,
 	    M_NOWAIT | M_ZERO);
@@ -6622,6 +9429,9 @@ urtwm_node_alloc(struct ieee80211vap *vap,
 		return NULL;
 
 	un->id = URTWM_MACID_UNDEFINED;
+	un->agg_limit = URTWM_AMPDU_MAX_AGG;
+	for (i = 0; i < WME_NUM_AC; i++)
+		mbufq_init(&un->tx_q[i], URTWM_TX_NQ_MAXLEN);
 
 	return &un->ni;
 }
@@ -6633,6 +9443,9 @@ urtwm_newassoc(struct ieee80211_node *ni, int isnew)
 	struct urtwm_node *un = URTWM_NODE(ni);
 	uint8_t id;
 
+	/* Node capabilities may be changed; rebuild Tx templates. */
+	atomic_add_int(&sc->sc_tx_tmpl_gen, 1);
+
 	if (!isnew)
 		return;
 
@@ -7146,7 +9959,8 @@ urtwm_init(struct urtwm_softc *sc)
 
 	/* Rx aggregation (USB). */
 	urtwm_write_2(sc, R92C_RXDMA_AGG_PG_TH,
-	    sc->ac_usb_dma_size | (sc->ac_usb_dma_time << 8));
+	    SM(R92C_RXDMA_AGG_PG_TH_SIZE, sc->ac_usb_dma_size) |
+	    SM(R92C_RXDMA_AGG_PG_TH_TIME, sc->ac_usb_dma_time));
 	urtwm_setbits_1(sc, R92C_TRXDMA_CTRL, 0,
 	    R92C_TRXDMA_CTRL_RXDMA_AGG_EN);
 
@@ -7265,7 +10079,19 @@ urtwm_init(struct urtwm_softc *sc)
 
 	urtwm_write_1(sc, R92C_USB_HRPWM, 0);
 
-	usbd_transfer_start(sc->sc_xfer[URTWM_BULK_RX]);
+	/* TSF was reset during power on. */
+	urtwm_tsf_cache_invalidate(sc, 0);
+	urtwm_tsf_cache_invalidate(sc, 1);
+
+	urtwm_rx_start(sc);
+
+	/* Start adaptive Rx aggregation. */
+	sc->sc_rxagg_cur = sc->sc_rxagg_def;
+	sc->sc_rxagg_prev_bytes = sc->sc_rx_bytes;
+	sc->sc_rxagg_prev_frames = sc->sc_rx_batch_frames;
+	sc->sc_rxagg_prev_xfers = sc->sc_rx_xfers;
+	sc->sc_rxagg_prev_dry = sc->sc_rx_ring_dry;
+	callout_reset(&sc->sc_rxagg_to, hz, urtwm_rxagg_to, sc);
 
 	sc->sc_flags |= URTWM_RUNNING;
 fail:
@@ -7294,6 +10120,8 @@ urtwm_stop(struct urtwm_softc *sc)
 	ieee80211_tx_watchdog_stop(&sc->sc_ic);
 #endif
 
+	callout_stop(&sc->sc_rxagg_to);
+	callout_stop(&sc->sc_tx_pg_to);
 	urtwm_abort_xfers(sc);
 	urtwm_drain_mbufq(sc);
 	urtwm_free_tx_list(sc);
@@ -7393,7 +10221,32 @@ static driver_t urtwm_driver = {
 
 static devclass_t urtwm_devclass;
 
-DRIVER_MODULE(urtwm, uhub, urtwm_driver, urtwm_devclass, NULL, NULL);
+/*
+ * The module cannot be unloaded while mbufs which point to loaned
+ * Rx buffers (and to urtwm_rx_ext_free()) are still in use.
+ */
+static int
+urtwm_modevent(module_t mod, int type, void *data)
+{
+	u_int orphans;
+
+	switch (type) {
+	case MOD_UNLOAD:
+		mtx_lock(&urtwm_rx_ext_mtx);
+		orphans = urtwm_rx_orphans;
+		mtx_unlock(&urtwm_rx_ext_mtx);
+		if (orphans != 0)
+			return (EBUSY);
+		break;
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+DRIVER_MODULE(urtwm, uhub, urtwm_driver, urtwm_devclass, urtwm_modevent,
+    NULL);
 MODULE_DEPEND(urtwm, usb, 1, 1, 1);
 MODULE_DEPEND(urtwm, wlan, 1, 1, 1);
 #ifndef URTWM_WITHOUT_UCODE
@@ -484,6 +484,13 @@
 #define R92C_PBP_512		3
 #define R92C_PBP_1024		4
 
+/* Bits for R92C_RXDMA_AGG_PG_TH. */
+#define R92C_RXDMA_AGG_PG_TH_SIZE_M	0x00ff
+#define R92C_RXDMA_AGG_PG_TH_SIZE_S	0
+#define R92C_RXDMA_AGG_PG_TH_TIME_M	0xff00
+#define R92C_RXDMA_AGG_PG_TH_TIME_S	8
+#define R12A_RXDMA_AGG_PG_UNIT		4096	/* USB: 4KB per unit */
+
 /* Bits for R92C_TRXDMA_CTRL. */
 #define R92C_TRXDMA_CTRL_RXDMA_AGG_EN		0x0004
 #define R92C_TRXDMA_CTRL_TXDMA_VOQ_MAP_M	0x0030
@@ -529,6 +536,18 @@
 #define R92C_RQPN_PUBQ_S	16
 #define R92C_RQPN_LD		0x80000000
 
+/* Bits for R92C_FIFOPAGE. */
+#define R92C_FIFOPAGE_HPQ_M	0x000000ff
+#define R92C_FIFOPAGE_HPQ_S	0
+#define R92C_FIFOPAGE_LPQ_M	0x0000ff00
+#define R92C_FIFOPAGE_LPQ_S	8
+#define R92C_FIFOPAGE_PUBQ_M	0x00ff0000
+#define R92C_FIFOPAGE_PUBQ_S	16
+
+/* Bits for R92C_RQPN_NPQ (16-bit access). */
+#define R92C_RQPN_NPQ_AVAIL_M	0xff00
+#define R92C_RQPN_NPQ_AVAIL_S	8
+
 /* Bits for R12A_DWBCN1_CTRL. */
 #define R12A_DWBCN1_CTRL_SEL_EN		0x00000002
 #define R12A_DWBCN1_CTRL_SEL_BCN1	0x00100000
@@ -1280,7 +1299,10 @@ struct r92c_rx_stat {
 	uint32_t	rxdw1;
 #define R92C_RXDW1_MACID_M	0x0000003f
 #define R92C_RXDW1_MACID_S	0
+#define R12A_RXDW1_TID_M	0x00000f00
+#define R12A_RXDW1_TID_S	8
 #define R12A_RXDW1_AMSDU	0x00002000
+#define R12A_RXDW1_PAGGR	0x00008000
 #define R12A_RXDW1_CKSUM_ERR	0x00100000
 #define R12A_RXDW1_IPV6		0x00200000
 #define R12A_RXDW1_UDP		0x00400000
@@ -1370,7 +1392,7 @@ struct r12a_c2h_tx_rpt {
 #define R12A_TXRPTB2_RETRY_CNT_M	0x3f
 #define R12A_TXRPTB2_RETRY_CNT_S	0
 
-	uint16_t	queue_time;	/* 256 msec unit */
+	uint16_t	queue_time;	/* 256 usec unit */
 	uint8_t		final_rate;
 	uint16_t	reserved;
 } __packed;
@@ -17,11 +17,67 @@
  * $FreeBSD$
  */
 
-#define URTWM_RX_LIST_COUNT		1
+#define URTWM_RX_LIST_COUNT		4
+#define URTWM_RX_LIST_MAX		16
 #define URTWM_TX_LIST_COUNT		16
-
-#define URTWM_RXBUFSZ	(8 * 1024)
+#define URTWM_TX_DEPTH_FS		1
+#define URTWM_TX_DEPTH_HS		2
+#define URTWM_TX_DEPTH_SS		4
+#define URTWM_TX_DEPTH_MAX		4
+#define URTWM_TX_RESV_MAX		(URTWM_TX_LIST_COUNT / WME_NUM_AC)
+#define URTWM_TX_WEIGHT_MAX		16
+#define URTWM_TX_RING_SIZE		512	/* power of 2 */
+
+#define URTWM_TX_BQL_TARGET		5	/* ms */
+#define URTWM_TX_BQL_INTERVAL		(100 * SBT_1MS)
+
+/* Per-station queues (hostap); see urtwm_tx_ac_first(). */
+#define URTWM_TX_NQ_MAXLEN		64	/* per station and AC */
+#define URTWM_TX_AIRTIME_QUANTUM	300	/* usec */
+#define URTWM_TX_AIRTIME_DEBT_MAX	(64 * URTWM_TX_AIRTIME_QUANTUM)
+/* Per-frame overhead (preamble, SIFS, ACK), usec. */
+#define URTWM_TX_AIRTIME_OVH_CCK	450
+#define URTWM_TX_AIRTIME_OVH_OFDM	64
+#define URTWM_TX_AIRTIME_OVH_HT		80
+
+/* A-MPDU length control; see urtwm_tx_ampdu_report(). */
+#define URTWM_AMPDU_MAX_AGG		0x1f	/* subframes */
+#define URTWM_AMPDU_WINDOW		32	/* Tx reports */
+#define URTWM_AMPDU_RETRY_HI		50	/* per 100 reports */
+#define URTWM_AMPDU_RETRY_LO		10
+
+/* Hardware Tx queues (one per bulk-out endpoint). */
+#define URTWM_TX_HWQ_HIGH		0
+#define URTWM_TX_HWQ_NORMAL		1
+#define URTWM_TX_HWQ_LOW		2
+#define URTWM_TX_NHWQ			3
+
+#define URTWM_RXBUFSZ		(8 * 1024)
+#define URTWM_RXBUFSZ_MIN	(4 * 1024)
+#define URTWM_RXBUFSZ_MAX	(32 * 1024)
+#define URTWM_RX_MCACHE_SIZE	64
+#define URTWM_RX_MCACHE_MAX	1024
+#define URTWM_RX_MCACHE_BUFSZ	MCLBYTES	/* larger frames use m_get2() */
+
+#define URTWM_BCN_FILTER_MAX	16
+
+#define URTWM_C2H_NTYPES	32	/* the last one counts unknown ids */
+
+#define URTWM_RX_HIST_SIZE	8
+
+/* Max. size of one Rx frame (with descriptor and PHY status). */
+#define URTWM_RX_MAXFRAMELEN	(sizeof(struct r92c_rx_stat) +	\
+	MS(R92C_RXDW0_INFOSZ_M, R92C_RXDW0_INFOSZ) * 8 + IEEE80211_MAX_LEN)
+
+/* Adaptive Rx aggregation (bytes per second). */
+#define URTWM_RXAGG_RATE_LOW	(256 * 1024)
+#define URTWM_RXAGG_RATE_HIGH	(4 * 1024 * 1024)
 #define URTWM_TXBUFSZ	(sizeof(struct r12a_tx_desc) + IEEE80211_MAX_LEN)
+#define URTWM_TXBUFSZ_AGG	(16 * 1024)
+
+/* Where the next descriptor will be placed (USB Tx aggregation). */
+#define URTWM_TX_DESC_NEXT(_data)	\
+	((struct r12a_tx_desc *)((_data)->buf + roundup2((_data)->buflen, 8)))
 
 #define URTWM_TX_TIMEOUT	5000	/* ms */
 #define URTWM_CALIB_THRESHOLD	6
@@ -59,17 +115,67 @@ struct urtwm_tx_radiotap_header {
 	(1 << IEEE80211_RADIOTAP_FLAGS |		\
 	 1 << IEEE80211_RADIOTAP_CHANNEL)
 
+/*
+ * Zero-copy Rx: trailer of a bulk-in buffer; must be valid as long
+ * as any mbuf still references the buffer (even after detach).
+ */
+struct urtwm_rx_ext {
+	u_int				refs;
+	int				returned;
+	struct urtwm_softc		*sc;
+};
+
+/*
+ * Node lookup cache; used during one Rx transfer only.
+ * 'last' is the last frame that borrowed the reference.
+ */
+struct urtwm_rx_node_cache {
+	struct ieee80211_node		*ni;
+	struct mbuf			*last;
+	uint8_t				macaddr[IEEE80211_ADDR_LEN];
+};
+
+/* Per-TID Rx statistics (QoS data frames from HT nodes only). */
+struct urtwm_rx_tid_stats {
+	uint64_t			reorder;	/* active BA session */
+	uint64_t			bypass;		/* no BA session */
+	uint64_t			paggr;		/* part of A-MPDU */
+};
+
+/* Per-frame data for urtwm_rx_deliver(). */
+#define URTWM_RX_DROP(_m)	((_m)->m_pkthdr.PH_loc.eight[0])
+#define URTWM_RX_NODE_REF(_m)	((_m)->m_pkthdr.PH_loc.eight[1])
+
 struct urtwm_data {
 	uint8_t				*buf;
+	uint8_t				*txbuf;	/* buf or mbuf headroom */
 	uint16_t			buflen;
+	uint8_t				qid;	/* Tx transfer */
+	uint8_t				aggnum;	/* frames in the buffer */
+	uint16_t			npages;	/* Tx packet buffer pages */
+	int				bql_bytes;	/* accounted in BQL */
+	/*
+	 * NB: subsequent frames (Tx aggregation) are linked via m_nextpkt;
+	 * their node references are stored in m_pkthdr.rcvif.
+	 */
 	struct mbuf			*m;
 	struct ieee80211_node		*ni;
+	struct urtwm_rx_ext		*ext;
+	sbintime_t			sbt;	/* Tx submit time */
+	sbintime_t			qsbt;	/* the first frame was added */
 	STAILQ_ENTRY(urtwm_data)	next;
 };
 typedef STAILQ_HEAD(, urtwm_data) urtwm_datahead;
 
 struct urtwm_softc;
 
+/* Last TSF value read from the chip (per port). */
+struct urtwm_tsf_cache {
+	uint64_t			tsf;
+	sbintime_t			sbt;	/* time of the read */
+};
+#define URTWM_TSF_CACHE_TIMEOUT		SBT_1S
+
 union sec_param {
 	struct ieee80211_key		key;
 	uint8_t				macid;
@@ -84,10 +190,72 @@ struct urtwm_cmdq {
 };
 #define URTWM_CMDQ_SIZE			16
 
+/*
+ * Exponentially weighted moving averages of PHY status values;
+ * stored with URTWM_EWMA_FRAC fractional bits.
+ */
+#define URTWM_EWMA_FRAC		4
+#define URTWM_EWMA_WEIGHT	3	/* new sample weight is 1/8 */
+#define URTWM_EWMA_UPDATE(_avg, _val, _first) do {			\
+	int32_t __v = (int32_t)(_val) * (1 << URTWM_EWMA_FRAC);	\
+	if (_first)							\
+		(_avg) = __v;						\
+	else								\
+		(_avg) += (__v - (_avg)) >> URTWM_EWMA_WEIGHT;		\
+} while (0)
+#define URTWM_EWMA_GET(_avg)	((_avg) >> URTWM_EWMA_FRAC)
+
+struct urtwm_rx_chain_stats {
+	int32_t			rssi;	/* dBm */
+	int32_t			snr;	/* 0.5 dB */
+	int32_t			evm;	/* 0.5 dB */
+};
+
+struct urtwm_node_rxstats {
+	int32_t			rssi;	/* dBm, all chains */
+	struct urtwm_rx_chain_stats chain[R92C_MAX_CHAINS];	/* OFDM only */
+	uint32_t		nsamples;
+	uint32_t		nsamples_ofdm;
+};
+
 struct urtwm_node {
 	struct ieee80211_node	ni;	/* must be the first */
 	uint8_t			id;
 	int8_t			last_rssi;
+	struct urtwm_node_rxstats rxstats;
+
+	/*
+	 * Tx descriptor templates for unicast data frames
+	 * ([0] - legacy rates, [1] - MCS); see urtwm_tx_tmpl_get().
+	 */
+	struct r12a_tx_desc	tx_tmpl[2];
+	struct ieee80211_channel *tx_tmpl_chan;
+	u_int			tx_tmpl_gen;
+	int			tx_tmpl_prot;
+
+	/* Software Tx queues and airtime accounting (hostap). */
+	struct mbufq		tx_q[WME_NUM_AC];
+	TAILQ_ENTRY(urtwm_node)	tx_next[WME_NUM_AC];
+	int			tx_active;	/* bitmask of listed ACs */
+	int			tx_deficit[WME_NUM_AC];	/* usec */
+	int32_t			tx_len_avg;	/* EWMA, bytes */
+	uint64_t		tx_frames;
+	uint64_t		tx_drops;
+	uint64_t		tx_airtime;	/* estimated, usec */
+	uint64_t		tx_airtime_retry; /* ... for retries */
+
+	/* A-MPDU length control. */
+	int			agg_limit;	/* subframes */
+	int			agg_pending[URTWM_MAX_TID]; /* per TID */
+	int			agg_win_rpts;
+	int			agg_win_retries;
+	int			agg_win_fails;
+	uint64_t		agg_frames;
+	uint64_t		agg_limit_sum;	/* per-frame limits */
+	uint64_t		agg_retries;
+	uint64_t		agg_fails;
+	uint64_t		agg_shrinks;
+	uint64_t		agg_grows;
 };
 #define URTWM_NODE(ni)	((struct urtwm_node *)(ni))
 
@@ -96,12 +264,25 @@ struct urtwm_vap {
 	int			id;
 #define URTWM_VAP_ID_INVALID	-1
 
+#if defined(INET) || defined(INET6)
+	struct lro_ctrl		lro;
+	int			lro_pending;
+#endif
+	void			(*if_input)(struct ifnet *, struct mbuf *);
+
 	struct r12a_tx_desc	bcn_desc;
 	struct mbuf		*bcn_mbuf;
 
 	struct callout		tsf_sync_adhoc;
 	struct task		tsf_sync_adhoc_task;
 
+	/* Beacon filter (STA mode). */
+	uint8_t			bcn_bssid[IEEE80211_ADDR_LEN];
+	uint32_t		bcn_hash;
+	int			bcn_hash_valid;
+	int			bcn_skip;	/* dropped in a row */
+	int			bcn_skip_max;	/* 0 - disabled */
+
 	int			(*newstate)(struct ieee80211vap *,
 				    enum ieee80211_state, int);
 	void			(*recv_mgmt)(struct ieee80211_node *,
@@ -117,14 +298,65 @@ enum {
 	URTWM_BULK_TX_BK,	/* = WME_AC_BK */
 	URTWM_BULK_TX_VI,	/* = WME_AC_VI */
 	URTWM_BULK_TX_VO,	/* = WME_AC_VO */
-	URTWM_N_TRANSFER = 5,
+	URTWM_BULK_RX_LAST = URTWM_BULK_TX_VO + URTWM_RX_LIST_MAX - 1,
+	URTWM_BULK_TX_EXTRA,
+	URTWM_BULK_TX_LAST =
+	    URTWM_BULK_TX_EXTRA + WME_NUM_AC * (URTWM_TX_DEPTH_MAX - 1) - 1,
+	URTWM_N_TRANSFER,
+};
+
+/* NB: the first Rx transfer is URTWM_BULK_RX, others follow Tx ones. */
+#define URTWM_BULK_RX_XFER(i)	\
+	((i) == 0 ? URTWM_BULK_RX : URTWM_BULK_TX_VO + (i))
+
+/* Tx queue index (0 .. WME_NUM_AC - 1) for URTWM_BULK_TX_* transfer. */
+#define URTWM_TX_QIDX(qid)	((qid) - URTWM_BULK_TX_BE)
+
+/* NB: additional Tx transfers are placed after the Rx ring. */
+#define URTWM_BULK_TX_XFER(sc, qid, i)					\
+	((i) == 0 ? (qid) : URTWM_BULK_TX_EXTRA +			\
+	    URTWM_TX_QIDX(qid) * ((sc)->sc_tx_depth - 1) + (i) - 1)
+
+struct urtwm_tx_ac_stats {
+	uint64_t		xfers;
+	uint64_t		frames;
+	uint64_t		bytes;
+	sbintime_t		lat_sum;	/* submit -> completion */
+	sbintime_t		lat_max;
+	uint64_t		drops;		/* software queue overflows */
+	int			qlen_max;
+};
+
+/* Byte queue limit for a Tx queue (see urtwm_tx_bql_complete()). */
+struct urtwm_tx_bql {
+	int			limit;		/* bytes */
+	int			limit_min;
+	int			limit_max;
+	int			inflight;	/* bytes in Tx buffers */
+	int			slack;		/* min. inflight per interval */
+	sbintime_t		last_adj;
+	sbintime_t		sojourn;	/* avg. buffered -> done */
+	sbintime_t		hw_qtime;	/* avg. chip queue time */
+	sbintime_t		hw_qtime_last;	/* last Tx report */
+	uint64_t		throttled;
+};
+
+enum {
+	URTWM_TX_SCHED_PRIO,	/* strict priority: VO, VI, BE, BK */
+	URTWM_TX_SCHED_DRR,	/* deficit round robin */
+	URTWM_TX_SCHED_MAX
 };
 
 #define	URTWM_EP_QUEUES	URTWM_BULK_RX
 
 struct urtwm_softc {
 	struct ieee80211com	sc_ic;
-	struct mbufq		sc_snd;
+	struct mbufq		sc_snd[WME_NUM_AC];
+	struct buf_ring		*sc_tx_ring;	/* see urtwm_transmit() */
+	struct task		sc_tx_task;
+	counter_u64_t		sc_tx_ring_drops;
+	counter_u64_t		sc_tx_lock_busy;
+	uint64_t		sc_tx_task_runs;
 	device_t		sc_dev;
 	struct usb_device	*sc_udev;
 
@@ -140,6 +372,7 @@ struct urtwm_softc {
 #define URTWM_IQK_RUNNING	0x0040
 #define URTWM_RXCKSUM_EN	0x0080
 #define URTWM_RXCKSUM6_EN	0x0100
+#define URTWM_RXLRO_EN		0x0200
 
 	uint8_t			chip;
 #define URTWM_CHIP_12A		0x01
@@ -208,19 +441,78 @@ struct urtwm_softc {
 	uint16_t		fwsig;
 	int			fwcur;
 
-	struct urtwm_data	sc_rx[URTWM_RX_LIST_COUNT];
+	struct urtwm_data	sc_rx[URTWM_RX_LIST_MAX];
+	int			sc_rx_list_count;
+	int			sc_rx_bufsz;
 	urtwm_datahead		sc_rx_active;
 	urtwm_datahead		sc_rx_inactive;
+	urtwm_datahead		sc_rx_loaned;
+	struct task		sc_rx_ext_task;
+	int			sc_rx_zerocopy;
+	urtwm_datahead		sc_rx_pending;
+	int			sc_rx_pending_cnt;
+	int			sc_rx_deferred;
+	int			sc_rx_queue_max;
+	struct taskqueue	*sc_rx_tq;
+	struct task		sc_rx_task;
+	struct mbuf		*sc_rx_mcache;	/* preallocated Rx mbufs */
+	int			sc_rx_mcache_cnt;
+	int			sc_rx_mcache_max;
+	int			sc_rx_mcache_lowat;
+	int			sc_rx_mcache_refill; /* refill is scheduled */
+	struct task		sc_rx_mcache_task;
 	struct urtwm_data	sc_tx[URTWM_TX_LIST_COUNT];
 	urtwm_datahead		sc_tx_active;
 	int			sc_tx_n_active;
 	urtwm_datahead		sc_tx_inactive;
-	urtwm_datahead		sc_tx_pending;
+	urtwm_datahead		sc_tx_pending[WME_NUM_AC];
+	int			sc_tx_depth;	/* transfers per queue */
+	struct urtwm_tx_ac_stats sc_tx_ac[WME_NUM_AC];
+	int			sc_tx_nbufs[WME_NUM_AC]; /* buffers in use */
+	int			sc_tx_resv[WME_NUM_AC];	/* ... reserved */
+	int			sc_tx_sched;	/* URTWM_TX_SCHED_* */
+	int			sc_tx_quantum[WME_NUM_AC]; /* DRR, bytes */
+	int			sc_tx_deficit[WME_NUM_AC];
+	int			sc_tx_drr_cur;
+	int			sc_tx_drr_visit; /* quantum was added */
+	int			sc_tx_airtime;	/* per-station queues */
+	int			sc_tx_ampdu_adapt;
+	TAILQ_HEAD(, urtwm_node) sc_tx_nodes[WME_NUM_AC]; /* active */
+	int			sc_tx_nq_len[WME_NUM_AC];
+
+	int			sc_tx_bql_on;
+	sbintime_t		sc_tx_bql_target;
+	struct urtwm_tx_bql	sc_tx_bql[WME_NUM_AC];
+
+	/* Tx packet buffer accounting; see urtwm_tx_pg_charge(). */
+	int			sc_tx_credit;
+	int			sc_tx_hwq[WME_NUM_AC];
+	int			sc_tx_pg_free[URTWM_TX_NHWQ]; /* last sample */
+	int			sc_tx_pg_pub;
+	int			sc_tx_pg_used[URTWM_TX_NHWQ];
+	int			sc_tx_pg_used_next[URTWM_TX_NHWQ];
+	int			sc_tx_pg_inflight[URTWM_TX_NHWQ];
+	int			sc_tx_pg_sampling;
+	int			sc_tx_pg_blocked; /* ACs waiting for pages */
+	struct callout		sc_tx_pg_to;
+	uint64_t		sc_tx_pg_samples;
+	uint64_t		sc_tx_pg_stalls;
+	int			sc_tx_bufsz;
+	int			sc_tx_agg_max;	/* frames per transfer */
+	uint64_t		sc_tx_xfers;	/* bulk-out transfers */
+	uint64_t		sc_tx_frames;	/* ... and frames in them */
+	int			sc_tx_zcopy;	/* send from mbuf headroom */
+	volatile u_int		sc_tx_tmpl_gen;	/* see urtwm_tx_tmpl_get() */
+	uint64_t		sc_tx_tmpl_builds;
+	uint64_t		sc_tx_zcopy_frames;
+	uint64_t		sc_tx_copy_frames;
+	uint64_t		sc_tx_copy_bytes;
 
 	uint16_t		next_rom_addr;
 	uint64_t		keys_bmap;
 
 	struct urtwm_vap	*vaps[2];
+	struct urtwm_tsf_cache	sc_tsf_cache[2];
 	struct ieee80211_node	*node_list[R12A_MACID_MAX + 1];
 	struct mtx		nt_mtx;
 
@@ -240,6 +532,50 @@ struct urtwm_softc {
 
 	struct wmeParams	cap_wmeParams[WME_NUM_AC];
 
+	/* Rx ring statistics. */
+	uint64_t		sc_rx_xfers;	/* completed transfers */
+	uint64_t		sc_rx_ring_dry;	/* no transfers were queued */
+	uint64_t		sc_rx_nobufs;	/* no free buffer to submit */
+	uint64_t		sc_rx_loans;	/* buffers held by the stack */
+	uint64_t		sc_rx_batches;	/* ieee80211_input() batches */
+	uint64_t		sc_rx_batch_frames; /* frames in all batches */
+	int			sc_rx_batch_max; /* largest batch seen */
+	uint64_t		sc_rx_queue_drops; /* Rx worker queue is full */
+	uint64_t		sc_rx_node_hits; /* node lookup cache hits */
+	uint64_t		sc_rx_node_misses; /* ... and misses */
+	uint64_t		sc_rx_hwdec;	/* decrypted by hardware */
+	int			sc_bcn_filter;	/* max. dropped in a row */
+	uint64_t		sc_rx_bcn_dropped; /* unchanged beacons */
+	uint64_t		sc_rx_bcn_keepalive; /* passed to keep bmiss */
+	uint64_t		sc_c2h_events[URTWM_C2H_NTYPES];
+	uint64_t		sc_c2h_inline;	/* not first in a transfer */
+	uint64_t		sc_rx_mcache_hits; /* mbuf taken from cache */
+	uint64_t		sc_rx_mcache_misses; /* cache was empty */
+	uint64_t		sc_rx_mcache_refills; /* refill task runs */
+	/* log2 histograms: bytes (from 1KB) / frames per transfer. */
+	uint64_t		sc_rx_hist_bytes[URTWM_RX_HIST_SIZE];
+	uint64_t		sc_rx_hist_frames[URTWM_RX_HIST_SIZE];
+	uint64_t		sc_rx_bytes;	/* received bytes */
+	struct urtwm_rx_tid_stats sc_rx_tid[WME_NUM_TID];
+
+	/* LRO (valid during urtwm_rx_deliver() only). */
+	struct thread		*sc_rx_lro_td;
+	struct urtwm_vap	*sc_rx_lro_vaps[2];
+	uint64_t		sc_rx_lro_queued; /* frames passed to LRO */
+	uint64_t		sc_rx_lro_flushes;
+
+	/* Adaptive Rx aggregation (urtwm_rxagg_cb()). */
+	struct callout		sc_rxagg_to;
+	int			sc_rxagg_def;	/* initial profile */
+	int			sc_rxagg_max;	/* must fit into Rx buffer */
+	int			sc_rxagg_cur;
+	int			sc_rxagg_pin;	/* -1 - auto */
+	uint64_t		sc_rxagg_changes;
+	uint64_t		sc_rxagg_prev_bytes;
+	uint64_t		sc_rxagg_prev_frames;
+	uint64_t		sc_rxagg_prev_xfers;
+	uint64_t		sc_rxagg_prev_dry;
+
 	struct urtwm_rx_radiotap_header	sc_rxtap;
 	struct urtwm_tx_radiotap_header	sc_txtap;
 
@@ -291,6 +627,7 @@ struct urtwm_softc {
 
 #define	URTWM_LOCK(sc)			mtx_lock(&(sc)->sc_mtx)
 #define	URTWM_UNLOCK(sc)		mtx_unlock(&(sc)->sc_mtx)
+#define	URTWM_TRYLOCK(sc)		mtx_trylock(&(sc)->sc_mtx)
 #define	URTWM_ASSERT_LOCKED(sc)		mtx_assert(&(sc)->sc_mtx, MA_OWNED)
 
 #define URTWM_CMDQ_LOCK_INIT(sc) \